@@ -1,18 +1,23 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 
-#include <c3.h>
 #include <layer/layer.h>
 #include <stdint.h>
 
 typedef void animation_manager; /* struct */
-typedef c3any_t animation; /* interface */
-typedef c3any_t spinner; /* interface */
+
+/* same order as the animation combo */
+enum animation_kind {
+    ANIMATION_NONE,
+    ANIMATION_SPINNER,
+    ANIMATION_SHAKE,
+    ANIMATION_FADE,
+};
 
 animation_manager *animation_manager_new();
 void animation_manager_tick(animation_manager *self);
 void animation_manager_add(animation_manager *self, struct layer *layer,
-    animation anim);
+    enum animation_kind kind);
 void animation_manager_selector(animation_manager *self, struct layer *layer,
     struct nk_context *ctx);
 void animation_manager_show(animation_manager *self);
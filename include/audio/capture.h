@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_DEFAULT_RATE 44100
+#define CAPTURE_PERIOD_FRAMES 128
+#define CAPTURE_PERIODS 2
+
+struct microphone_data;
+
+struct capture_config {
+    /* explicit period size and count instead of miniaudio's defaults */
+    bool low_latency;
+    int period_frames;
+    int periods;
+    /* capture at the device rate, skips resampling to CAPTURE_DEFAULT_RATE */
+    bool native_rate;
+};
+
+/* opens the capture device as mic->config says and starts it */
+int capture_start(struct microphone_data *mic);
+void capture_stop(struct microphone_data *mic);
+/* stops and starts again with the current config */
+int capture_restart(struct microphone_data *mic);
+/* what the device buffers, in milliseconds */
+float capture_buffer_latency(struct microphone_data *mic);
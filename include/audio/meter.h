@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* time the envelope takes to follow a rise and a fall, in seconds */
+#define METER_ATTACK 0.010f
+#define METER_RELEASE 0.150f
+
+struct level_snapshot {
+    float rms;
+    float peak;
+    float envelope;
+    /* samples measured so far, tells snapshots of different blocks apart */
+    uint64_t samples;
+};
+
+/*
+ * Level meter of the capture callback. The audio thread measures every
+ * block in a single SIMD pass and publishes the result through a seqlock,
+ * so it never waits on a reader and readers never see a torn snapshot.
+ */
+struct level_meter {
+    /* odd while a snapshot is being written */
+    atomic_uint sequence;
+    _Atomic float rms;
+    _Atomic float peak;
+    _Atomic float envelope;
+    _Atomic uint64_t samples;
+
+    /* audio thread only */
+    float sample_rate;
+    float current_envelope;
+    uint64_t total;
+};
+
+void level_meter_init(struct level_meter *m, uint32_t sample_rate);
+/* realtime safe, one writer only, returns what it published */
+struct level_snapshot level_meter_process(struct level_meter *m,
+    const float *samples, size_t count);
+struct level_snapshot level_meter_read(struct level_meter *m);
+
+/* sum of squares and peak magnitude of count samples */
+void level_measure(const float *samples, size_t count, float *sum, float *peak);
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* power of two, a few seconds of capture blocks */
+#define LEVEL_RING_SIZE 512
+/* power of two, close to 200 ms of samples at 44.1 kHz */
+#define SAMPLE_RING_SIZE 8192
+
+/* one capture block as the audio thread saw it */
+struct level_frame {
+    /* uv_hrtime when the block arrived */
+    uint64_t time;
+    /* sample position at the end of the block */
+    uint64_t position;
+    float rms;
+    float peak;
+    /* sample position the VAD state last changed at */
+    uint64_t since;
+    bool talking;
+};
+
+/*
+ * Single producer, single consumer ring from the capture callback to the
+ * render thread. Head and tail sit on their own cache lines, each side
+ * only ever writes its own.
+ */
+struct level_ring {
+    alignas(64) atomic_size_t head;
+    alignas(64) atomic_size_t tail;
+    alignas(64) struct level_frame frames[LEVEL_RING_SIZE];
+};
+
+/* false when the consumer fell behind, the frame is dropped then */
+bool level_ring_push(struct level_ring *r, const struct level_frame *frame);
+bool level_ring_pop(struct level_ring *r, struct level_frame *frame);
+
+/* raw capture samples for analysis off the audio thread, same scheme */
+struct sample_ring {
+    alignas(64) atomic_size_t head;
+    alignas(64) atomic_size_t tail;
+    alignas(64) float samples[SAMPLE_RING_SIZE];
+};
+
+/* copies what fits, the rest is dropped, returns how many were taken */
+size_t sample_ring_write(struct sample_ring *r, const float *samples,
+    size_t count);
+/* false until count samples are there, nothing is taken then */
+bool sample_ring_read(struct sample_ring *r, float *samples, size_t count);
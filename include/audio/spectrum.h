@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdint.h>
+
+/* power of two, about 11 ms at 44.1 kHz and 86 Hz a bin */
+#define SPECTRUM_SIZE 512
+#define SPECTRUM_BINS (SPECTRUM_SIZE / 2)
+
+/*
+ * Power spectrum of a Hann windowed block, radix-2 FFT with the window,
+ * twiddles and bit reversal worked out once. Nothing is allocated, one
+ * instance belongs to one thread.
+ */
+struct spectrum {
+    float bin_hz;
+    float window[SPECTRUM_SIZE];
+    float cos[SPECTRUM_SIZE / 2];
+    float sin[SPECTRUM_SIZE / 2];
+    uint16_t reverse[SPECTRUM_SIZE];
+    float re[SPECTRUM_SIZE];
+    float im[SPECTRUM_SIZE];
+    float power[SPECTRUM_BINS];
+};
+
+void spectrum_init(struct spectrum *s, uint32_t sample_rate);
+/* SPECTRUM_SIZE samples in, SPECTRUM_BINS powers out, valid until the next call */
+const float *spectrum_power(struct spectrum *s, const float *samples);
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <core/mask.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum talk_state {
+    TALK_QUIET,
+    TALK_TALKING,
+    TALK_PAUSED,
+};
+
+/*
+ * Talk, pause and quiet from the VAD stream. Time is whatever clock the
+ * caller feeds in, milliseconds of captured audio in the editor, so the
+ * same trace always gives the same transitions. After the voice stops
+ * the model keeps talking for ttl / 2 and pauses until ttl.
+ */
+struct talk_fsm {
+    enum talk_state state;
+    bool voiced;
+    /* when the voice last stopped */
+    uint64_t stopped_at;
+};
+
+void talk_fsm_init(struct talk_fsm *f);
+/* voiced as of now, since is when that last changed, calls come in time order */
+void talk_fsm_step(struct talk_fsm *f, bool voiced, uint64_t since,
+    uint64_t now, uint32_t ttl);
+/* mask with its state bits replaced by the ones of the current state */
+mask_t talk_fsm_apply(const struct talk_fsm *f, mask_t mask);
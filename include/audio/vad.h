@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* voice band, keeps out rumble and most of a keyboard click */
+#define VAD_LOW_HZ 300.0f
+#define VAD_HIGH_HZ 3400.0f
+/* analysis window, the callback block size does not matter */
+#define VAD_WINDOW_MS 10
+/* windows over the threshold before talking starts, a click is shorter */
+#define VAD_ONSET_WINDOWS 2
+/* how long talking holds after the voice drops */
+#define VAD_HANGOVER_MS 200
+/* band energy has to be this far over the noise floor */
+#define VAD_MARGIN 2.0f
+/* noise floor creep, per second */
+#define VAD_FLOOR_RISE 1.5f
+
+struct biquad {
+    float b0, b1, b2, a1, a2;
+    float z1, z2;
+};
+
+/*
+ * Voice activity detection on the capture thread. Every window the RMS of
+ * the voice band is compared against both the user gate and a tracked
+ * noise floor. The state is published as one atomic word, so a reader
+ * sees when it changed together with the state itself.
+ */
+struct vad {
+    /* written by any thread, band RMS needed to talk at all */
+    _Atomic float gate;
+    /* sample position of the last change << 1 | talking */
+    _Atomic uint64_t state;
+
+    /* audio thread only */
+    struct biquad highpass;
+    struct biquad lowpass;
+    float sample_rate;
+    size_t window;
+    size_t window_fill;
+    float window_sum;
+    float noise_floor;
+    int onset;
+    size_t hangover;
+    size_t hangover_left;
+    bool talking;
+    uint64_t position;
+};
+
+void vad_init(struct vad *v, uint32_t sample_rate);
+/* realtime safe, one writer only */
+void vad_process(struct vad *v, const float *samples, size_t count);
+void vad_set_gate(struct vad *v, float gate);
+/* talking or not, since is the sample position of the change */
+bool vad_read(struct vad *v, uint64_t *since);
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <audio/ring.h>
+#include <audio/spectrum.h>
+#include <audio/vad.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+/* new samples per analysis, blocks overlap by half */
+#define VISEME_HOP (SPECTRUM_SIZE / 2)
+/* formants are looked for below this, the rest of the spectrum is ignored */
+#define VISEME_BAND_HZ 4000.0f
+/* lowest F1 taken, the voice pitch sits below */
+#define VISEME_F1_MIN_HZ 200.0f
+/* all-pole model of the band, two poles a formant for F1 to F4 */
+#define VISEME_ORDER 8
+/* flattens the voice tilt so F2 stands out, (1 + f / hz)^2 */
+#define VISEME_EMPHASIS_HZ 300.0f
+/* F2 of spread lips, i e and a as in had */
+#define VISEME_WIDE_F2 1500.0f
+/* F1 + F2 of an open jaw, below it is rounded, o and u */
+#define VISEME_OPEN_SUM 1750.0f
+/* hops a new shape has to last before it shows */
+#define VISEME_HOLD 2
+
+/* mask bit is 1ULL << (viseme + VISEME_START) */
+enum viseme {
+    VISEME_CLOSED,
+    VISEME_OPEN,
+    VISEME_WIDE,
+    VISEME_ROUND,
+};
+
+/*
+ * Mouth shape of a voiced block from its first two formants. The power
+ * spectrum below VISEME_BAND_HZ gives the autocorrelation of the band, an
+ * LPC fit of that is smooth enough to find F1 and F2 as its first peaks
+ * even with sparse harmonics of a high voice.
+ */
+struct viseme_classifier {
+    float bin_hz;
+    int bins;
+    float weight[SPECTRUM_BINS];
+    float cos[VISEME_ORDER + 1][SPECTRUM_BINS];
+    float sin[VISEME_ORDER + 1][SPECTRUM_BINS];
+};
+
+/*
+ * Spectral analysis of the microphone on its own thread. The capture
+ * callback only copies samples into the ring, every hop is analysed here
+ * and the shape is published as one atomic, closed while the VAD says
+ * nobody talks.
+ */
+struct viseme_analyzer {
+    /* capture callback to analysis thread */
+    struct sample_ring ring;
+    /* posted after every feed, the thread sleeps on it while short of a hop */
+    uv_sem_t fed;
+    /* enum viseme, read by anyone */
+    atomic_int viseme;
+    /* microseconds a hop took, smoothed */
+    _Atomic float cost;
+    atomic_bool quit;
+    uv_thread_t thread;
+    bool running;
+    float hop_ms;
+
+    /* analysis thread only */
+    struct vad *vad;
+    struct spectrum spectrum;
+    struct viseme_classifier classifier;
+    float block[SPECTRUM_SIZE];
+    enum viseme candidate;
+    int candidate_hops;
+};
+
+void viseme_classifier_init(struct viseme_classifier *c, float bin_hz);
+enum viseme viseme_classify(const struct viseme_classifier *c,
+    const float *power);
+
+/* starts the analysis thread, the capture callback must not run yet */
+int viseme_start(struct viseme_analyzer *a, struct vad *vad,
+    uint32_t sample_rate);
+/* joins the analysis thread, the capture callback must be stopped */
+void viseme_stop(struct viseme_analyzer *a);
+/* realtime safe, capture callback only, drops what does not fit */
+void viseme_feed(struct viseme_analyzer *a, const float *samples,
+    size_t count);
+enum viseme viseme_read(struct viseme_analyzer *a);
@@ -17,6 +17,7 @@
 #include <stdatomic.h>
 #include <raylib.h>
 #include <ui/filedialog.h>
+#include <ui/redraw.h>
 #include <core/microphone.h>
 #if 0
 #include <lua.h>
@@ -49,6 +50,7 @@ struct image_load_req {
     uv_work_t req;
     uint8_t *buffer;
     uint8_t *gif_buffer;
+    uint8_t *png_buffer;
     int *delays;
     size_t size;
     char *name;
@@ -90,6 +92,13 @@ struct context {
     mask_t mask;
 
     Camera2D camera;
+    /* what was on screen last, see editor.render_skip */
+    struct redraw redraw;
+    uv_idle_t draw_task;
+    uv_idle_t update_task;
+    /* nothing changed, the idle tasks are stopped until frame_timer fires */
+    uv_timer_t frame_timer;
+    bool frame_wait;
 
     struct editor editor;
     struct microphone_data mic;
@@ -101,6 +110,10 @@ struct context {
 
     enum program_mode mode;
     bool hide_ui;
+    /* store decoded pixels next to the PNG/GIF when saving */
+    bool save_pixel_cache;
+    /* write the seekable v2 container instead of a tar */
+    bool save_indexed;
 };
 
 void context_load_image(struct context *ctx, const char *name,
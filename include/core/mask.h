@@ -12,6 +12,7 @@ typedef uint64_t mask_t;
  * 0-2 bits - state
  * 3-6 bits - mod keys
  * 7-33 bits - ASCII key
+ * 34-37 bits - mouth shape
  */
 
 /* true when one matches */
@@ -37,13 +38,37 @@ enum mask_key {
     KEY_START = 7,
 };
 
+/*
+ * 1ULL << (viseme + VISEME_START), set from the microphone
+ * true when one matches, a layer without any does not care
+ */
+enum mask_viseme {
+    VISEME_START = 34,
+    VISEME_COUNT = 4,
+};
+
+#define VISEMES (((1ULL << VISEME_COUNT) - 1) << VISEME_START)
+
 #define DEFAULT_MASK (QUIET | TALK | PAUSE)
 
+/* test_masks for one target, see compile_mask */
+struct mask_predicate {
+    mask_t care;
+    mask_t want;
+    mask_t any;
+    mask_t shape;
+};
+
 void set_current_mask(mask_t mask);
 mask_t get_current_mask();
 
 void set_key_mask(mask_t *mask);
 void handle_key_mask(mask_t *mask);
 bool test_masks(mask_t mask, mask_t target);
+/*
+ * (mask & care) == want && (mask & any) != 0 && (mask & shape) != 0
+ * gives the same as test_masks
+ */
+struct mask_predicate compile_mask(mask_t target);
 void configure_mask(mask_t *mask, char *input, int *size,
     struct nk_context *ctx, const char *label);
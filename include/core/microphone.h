@@ -3,10 +3,24 @@
 #pragma once
 
 #include "miniaudio.h"
+#include <audio/capture.h>
+#include <audio/meter.h>
+#include <audio/ring.h>
+#include <audio/vad.h>
+#include <audio/viseme.h>
 #include <stdatomic.h>
 
 struct microphone_data {
-    atomic_size_t volume;
+    /* written by the capture callback, read through snapshots */
+    struct level_meter meter;
+    /* talking or not, decided on the capture thread */
+    struct vad vad;
+    /* every block for the render thread, drained once per frame */
+    struct level_ring ring;
+    /* mouth shape, worked out on its own thread */
+    struct viseme_analyzer viseme;
     atomic_int multiplier;
     ma_device device;
+    struct capture_config config;
+    bool running;
 };
@@ -3,6 +3,7 @@
 #define _EDITOR_H_
 
 #include <archive.h>
+#include <audio/talk.h>
 #include <core/microphone.h>
 #include "ui/window.h"
 #include <layer/manager.h>
@@ -32,14 +33,19 @@ struct editor {
     struct window win;
     struct microphone_data *mic;
     size_t previous_volume;
+    /* capture block to render thread, milliseconds, smoothed */
+    float capture_delay;
     size_t microphone_trigger;
     Color background_color;
     char bg_color_in[7];
     int bg_color_len;
     int timer_ttl;
-
-    bool talk_timer_running;
-    bool pause_timer_running;
+    /* present nothing new while the frame would look the same */
+    bool render_skip;
+    struct talk_fsm talk;
+    /* milliseconds of audio at the last capture block, and its uv_hrtime */
+    uint64_t talk_clock;
+    uint64_t talk_clock_time;
 };
 
 void editor_draw(struct editor *editor, struct nk_context *ctx, bool *ui_focused);
@@ -1,7 +1,11 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <raylib.h>
+#include <layer/frames.h>
+#include <layer/gif.h>
 
 struct animated_layer_properties {
     uint8_t *gif_file_content;
@@ -10,4 +14,13 @@ struct animated_layer_properties {
     uint64_t number_of_frames;
     uint64_t current_frame_index;
     uint64_t previous_frame_index;
+    /* every frame on the GPU, [0] is the layer texture. NULL over budget or streamed */
+    Texture2D *frame_textures;
+    /* frames in GIF form, the image holds no pixels then */
+    struct indexed_frames *indexed;
+    /* decoded a few frames ahead from gif_file_content, the image holds one frame */
+    struct gif_stream *stream;
+    /* GetTime() when the current frame came up, negative until the next tick */
+    double frame_started;
+    bool is_playing;
 };
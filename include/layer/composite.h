@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdint.h>
+#include <raylib.h>
+#include <layer/properties.h>
+
+/* composites bigger than this are not worth the VRAM, the run draws directly */
+#define COMPOSITE_MAX_SIZE 8192
+
+/*
+ * A run of adjacent static layers flattened into one texture. The
+ * composite is premultiplied, so layers blend into it exactly like they
+ * would blend into the scene.
+ */
+struct layer_composite {
+    RenderTexture2D target;
+    /* scene space, whole pixels so the texels line up at zoom 1 */
+    Rectangle bounds;
+    /* what the composite holds, rebuilt when it no longer matches */
+    uint64_t key;
+};
+
+/* grows bounds by the area the layer covers when drawn at anchor */
+void layer_composite_extend(Rectangle *bounds, const struct layer_properties *props,
+    Vector2 anchor);
+/* false if bounds are too big, draw the layers at the returned anchor otherwise */
+bool layer_composite_begin(struct layer_composite *c, Rectangle bounds,
+    Vector2 *anchor);
+void layer_composite_end(struct layer_composite *c);
+void layer_composite_draw(const struct layer_composite *c);
+void layer_composite_free(struct layer_composite *c);
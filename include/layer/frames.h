@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <raylib.h>
+
+#define INDEXED_PALETTE_SIZE 256
+
+/*
+ * Decoded GIF frames kept the way GIF stores them, 8-bit indices into a
+ * palette of up to 256 colors per frame. A frame is only expanded to RGBA
+ * when it has to be uploaded.
+ */
+struct indexed_frames {
+    int width;
+    int height;
+    size_t frame_count;
+    Color *palettes;
+    uint8_t *indices;
+    /* one RGBA frame, reused by every expansion */
+    uint8_t *scratch;
+};
+
+/* false if a frame uses more than 256 colors, f is left empty then */
+bool indexed_frames_from_rgba(struct indexed_frames *f, const uint8_t *rgba,
+    int width, int height, size_t frame_count);
+/* expanded frame in f->scratch, valid until the next call */
+const uint8_t *indexed_frames_expand(struct indexed_frames *f, size_t frame);
+size_t indexed_frames_size(const struct indexed_frames *f);
+void indexed_frames_free(struct indexed_frames *f);
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <raylib.h>
+
+#define GIF_MAX_CODES 4096
+#define GIF_STREAM_WINDOW 3
+
+/*
+ * Frame by frame GIF decoder, composes frames the same way stb_image does
+ * but only ever holds the current canvas. Opening scans the blocks once
+ * for the frame count and delays, no pixels are decoded until asked for.
+ * Like stb_image, reads past the end see zeros, extension state carries
+ * over to frames without one, disposal 2 restores what the frame drew
+ * over and disposal 3 what was shown two frames back. The scan cannot see
+ * a bad code in the middle of a frame, stb_image drops that frame and the
+ * ones after it, here they are counted and shown as far as they decode.
+ */
+struct gif_decoder {
+    const uint8_t *data;
+    size_t size;
+    /* first block after the global palette and the next one to read */
+    size_t start;
+    size_t pos;
+
+    int width;
+    int height;
+    bool has_palette;
+    int background_index;
+    /* alpha is 0 for the transparent index and 255 for the others */
+    Color palette[256];
+    Color local[256];
+
+    size_t frame_count;
+    /* milliseconds, owned until taken */
+    int *delays;
+    /* index of the frame the next call decodes */
+    size_t frame;
+
+    /* flags and index of the last graphic control extension */
+    int control;
+    int transparent;
+
+    uint8_t *canvas;
+    /* pixels the last frame wrote */
+    uint8_t *history;
+    /* canvas before the last frame was drawn, NULL without disposal 2 or 3 */
+    uint8_t *background;
+    /* the last two frames as shown, NULL without disposal 3 */
+    uint8_t *shown[2];
+
+    uint16_t prefix[GIF_MAX_CODES];
+    uint8_t suffix[GIF_MAX_CODES];
+    uint8_t first[GIF_MAX_CODES];
+    uint8_t stack[GIF_MAX_CODES + 1];
+};
+
+/*
+ * Frames of a layer that is too big to keep decoded, see layer_animated_streams.
+ * The window is least recently used first, the shown frame is never evicted.
+ * One frame at a time may be decoded ahead on another thread, the decoder
+ * and its slot belong to that thread until gif_stream_ahead_end.
+ */
+struct gif_stream {
+    struct gif_decoder decoder;
+    uint8_t *ring[GIF_STREAM_WINDOW];
+    size_t ring_frame[GIF_STREAM_WINDOW];
+    uint64_t ring_used[GIF_STREAM_WINDOW];
+    uint64_t uses;
+    /* last frame handed to the draw */
+    size_t shown;
+
+    /* decode ahead in flight, SIZE_MAX when there is none */
+    size_t ahead;
+    size_t ahead_slot;
+    bool ahead_failed;
+    /* released while decoding ahead, gif_stream_ahead_end frees it */
+    bool orphaned;
+};
+
+int gif_decoder_open(struct gif_decoder *d, const uint8_t *data, size_t size);
+/* composes the next frame and copies it to rgba, wraps around after the last */
+int gif_decoder_next(struct gif_decoder *d, uint8_t *rgba);
+void gif_decoder_rewind(struct gif_decoder *d);
+void gif_decoder_close(struct gif_decoder *d);
+
+int gif_stream_open(struct gif_stream *s, const uint8_t *data, size_t size);
+/* malloc'd and opened, NULL when data does not decode */
+struct gif_stream *gif_stream_new(const uint8_t *data, size_t size);
+/*
+ * RGBA pixels of frame, decoded on demand, valid while it stays in the window.
+ * NULL while the frame is not in the window and the decoder is busy ahead.
+ */
+const uint8_t *gif_stream_frame(struct gif_stream *s, size_t frame);
+/*
+ * Reserves a slot for frame that holds neither keep nor the shown frame,
+ * false when frame is there already or would need a long rewind.
+ */
+bool gif_stream_ahead_begin(struct gif_stream *s, size_t frame, size_t keep);
+/* the only call allowed off the main thread, decodes the reserved frame */
+void gif_stream_ahead_decode(struct gif_stream *s);
+/* back on the main thread, true when the stream was released meanwhile and is gone */
+bool gif_stream_ahead_end(struct gif_stream *s);
+bool gif_stream_busy(const struct gif_stream *s);
+size_t gif_stream_size(const struct gif_stream *s);
+void gif_stream_close(struct gif_stream *s);
+/* closes and frees a gif_stream_new one, or leaves that to gif_stream_ahead_end */
+void gif_stream_release(struct gif_stream *s);
@@ -2,10 +2,13 @@
 #pragma once
 
 #include "unuv.h"
+#include <stdbool.h>
 #include <layer/properties.h>
 #include <layer/state.h>
 #include <layer/animated_properties.h>
 
+struct work_scheduler;
+
 struct layer {
     struct layer_properties properties;
     struct layer_state state;
@@ -26,9 +29,31 @@ void layer_start_timeout(struct layer *layer, un_loop *loop);
 void layer_toggle(struct layer *layer, un_loop *loop);
 
 void layer_override_name(struct layer *layer, char *name);
+void layer_set_encoded(struct layer *layer, uint8_t *buffer, uint64_t size);
 
 struct animated_layer *layer_get_animated(struct layer *layer);
-void layer_animated_start(struct animated_layer *layer, un_loop *loop);
+/* plays from the first frame, layer_animated_tick does the rest */
+void layer_animated_start(struct animated_layer *layer);
+/*
+ * Advances to the frame due at now (seconds), called once per rendered frame.
+ * Streamed layers queue the next frame on sched to be decoded ahead.
+ */
+void layer_animated_tick(struct animated_layer *layer, double now,
+    struct work_scheduler *sched);
+/* too big to keep decoded, such layers decode frames as they play */
+bool layer_animated_streams(int width, int height, size_t frames);
+/* thread safe, only the first frame when the animation streams */
+Image layer_load_gif(const uint8_t *data, size_t size, int *frames, int **delays);
+/* uploads every frame once, called on creation */
+void layer_animated_upload(struct animated_layer *layer);
+void layer_animated_unload(struct animated_layer *layer);
+/* moves the frames into indexed form when every frame fits a palette */
+void layer_animated_compact(struct animated_layer *layer);
+/* RGBA pixels of a frame, valid until the next call, NULL as in gif_stream_frame */
+const uint8_t *layer_animated_frame(struct animated_layer *layer, size_t frame);
+/* false when the frame is not decoded yet, the texture keeps the last one */
+bool layer_animated_update_frame(struct animated_layer *layer);
 
 char *layer_stringify(struct layer *layer);
 void layer_cleanup(struct layer *layer);
+void layer_free(struct layer *layer);
@@ -17,6 +17,19 @@ struct layer_manager *layer_manager_init();
 
 void layer_manager_cleanup(struct layer_manager *mgr);
 void layer_manager_add_layer(struct layer_manager *mgr, struct layer *layer);
+/* frees the current layers and adds these, the array stays the caller's */
+void layer_manager_replace_layers(struct layer_manager *mgr, struct layer **layers,
+    size_t count);
+/* while pinned, layers are neither deleted nor replaced */
+void layer_manager_pin(struct layer_manager *mgr);
+void layer_manager_unpin(struct layer_manager *mgr);
+bool layer_manager_is_pinned(struct layer_manager *mgr);
 
 void layer_manager_ui(struct layer_manager *mgr, struct nk_context *ctx);
 void layer_manager_render(struct layer_manager *mgr, un_loop *loop);
+/* flattens static layer runs, call outside of BeginMode2D before rendering */
+void layer_manager_prepare(struct layer_manager *mgr);
+/* advances animated layers to the current frame, call before drawing */
+void layer_manager_tick(struct layer_manager *mgr, struct work_scheduler *sched);
+uint64_t layer_manager_signature(struct layer_manager *mgr);
+bool layer_manager_is_animating(struct layer_manager *mgr);
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <raylib.h>
 #include <ui/line_edit.h>
 
@@ -15,7 +16,13 @@ struct layer_properties {
 
     struct line_edit name;
 
+    /* encoded PNG the image came from, written verbatim on save */
+    uint8_t *png_file_content;
+    uint64_t png_file_size;
+
     bool has_toggle;
     bool is_animated;
+    /* pixels no longer match png_file_content */
+    bool is_dirty;
 };
 
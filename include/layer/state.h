@@ -2,11 +2,12 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <core/mask.h>
-#include <c3.h>
 
 struct layer_state {
-    c3any_t anim;
+    /* 1 + transform slot of the animation manager, 0 without an animation */
+    size_t anim;
     mask_t mask;
     mask_t anim_mask;
 
@@ -22,5 +23,10 @@ struct layer_state {
 
     char anim_input_key_buffer[2];
     int anim_input_key_len;
+
+    struct mask_predicate predicate;
+    mask_t compiled_from;
+    size_t bucket;
+    bool in_mask;
 };
 
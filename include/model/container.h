@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <zstd.h>
+
+/*
+ * Indexed .opng (v2)
+ *
+ * header | zstd frame per entry ... | table of contents
+ *
+ * Every entry is its own zstd frame that records its size, so any of
+ * them can be decompressed without touching the others, from any thread. The table of contents is
+ * a list of records, each followed by its pathname (not terminated).
+ * v1 models are zstd compressed tars and never start with the magic.
+ */
+#define CONTAINER_MAGIC "OPNGIDX"
+#define CONTAINER_VERSION 2
+/* ZSTD_BLOCKSIZE_MAX, which zstd.h only has for static linking */
+#define CONTAINER_MAX_BLOCK (128 * 1024)
+
+struct container_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t toc_offset;
+    uint64_t toc_size;
+};
+
+struct container_record {
+    uint64_t offset;
+    uint64_t compressed_size;
+    uint64_t size;
+    uint32_t pathname_length;
+    uint32_t reserved;
+};
+
+struct container_entry {
+    char *pathname;
+    uint64_t offset;
+    uint64_t compressed_size;
+    uint64_t size;
+};
+
+/* read only view of a mapped container, entries are sorted by pathname */
+struct container {
+    const uint8_t *base;
+    size_t size;
+    struct container_entry *entries;
+    size_t entry_count;
+};
+
+struct container_writer {
+    FILE *file;
+    ZSTD_CCtx *cctx;
+    uint8_t *out;
+    size_t out_size;
+
+    struct container_entry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    /* entry being written, if any */
+    struct container_entry *current;
+    uint64_t offset;
+    bool failed;
+};
+
+bool container_detect(const void *data, size_t size);
+int container_open(struct container *c, const void *data, size_t size);
+const struct container_entry *container_find(struct container *c, const char *pathname);
+/* thread safe, returns a malloc'd copy, terminated when terminate is set */
+uint8_t *container_read(struct container *c, const struct container_entry *entry,
+    bool terminate);
+void container_close(struct container *c);
+
+int container_writer_open(struct container_writer *w, const char *path);
+void container_writer_begin(struct container_writer *w, const char *pathname,
+    uint64_t size);
+void container_writer_data(struct container_writer *w, const void *data, size_t size);
+void container_writer_end(struct container_writer *w);
+int container_writer_close(struct container_writer *w);
@@ -9,8 +9,17 @@ struct model {
     struct work_scheduler *scheduler;
     struct microphone_data *mic;
     struct editor *editor;
+    /* owned by the load in progress, if any, saves are refused until it is done */
+    struct work_token *load_token;
 };
 
 char *model_generate_manifest(struct model *model);
-void model_write(struct model *model, const char *path);
+enum model_write_flags {
+    /* also store decoded pixels for faster loading, see pixel_cache.h */
+    MODEL_WRITE_PIXEL_CACHE = 1 << 0,
+    /* indexed v2 container instead of a tar, see container.h */
+    MODEL_WRITE_INDEXED = 1 << 1,
+};
+
+void model_write(struct model *model, const char *path, int flags);
 void model_load(un_loop *loop, struct model *model, const char *path);
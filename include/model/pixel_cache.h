@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Optional cache/<name>-<index>.pxl entries hold layer pixels exactly as
+ * raylib keeps them in memory, so loading skips the PNG and GIF decoders.
+ * The header is followed by GetPixelDataSize(width, height, format) bytes
+ * for every frame. Loaders fall back to layers/ when it is missing or stale.
+ */
+#define PIXEL_CACHE_MAGIC "OPXC"
+#define PIXEL_CACHE_VERSION 1
+/* bigger than any texture raylib creates, keeps the size sums in range */
+#define PIXEL_CACHE_MAX_DIMENSION 16384
+
+struct pixel_cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t frames;
+};
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include <raylib-nuklear.h>
+#include <core/mask.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Everything outside of Nuklear that ends up in a frame. Fill it after a
+ * memset so padding compares equal too.
+ */
+struct redraw_state {
+    mask_t mask;
+    Camera2D camera;
+    Color background;
+    int mode;
+    int width;
+    int height;
+    bool focused;
+    bool hide_ui;
+    /* layer_manager_signature */
+    uint64_t layers;
+};
+
+/*
+ * Decides whether a frame has to be drawn at all. The UI is compared by its
+ * Nuklear command buffer, which is the same between frames unless something
+ * in the UI changed, the rest by a redraw_state.
+ */
+struct redraw {
+    struct redraw_state last;
+    /* commands of the last presented UI */
+    uint8_t *commands;
+    size_t commands_size;
+    size_t commands_capacity;
+    bool valid;
+};
+
+/* true when the frame differs from the last presented one, it is remembered then */
+bool redraw_needed(struct redraw *r, const struct redraw_state *state,
+    struct nk_context *nk);
+/* the next frame is drawn no matter what */
+void redraw_invalidate(struct redraw *r);
+void redraw_free(struct redraw *r);
@@ -1,21 +1,55 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 
-struct work_queue {
-    struct _work_queue_node *head;
-    struct _work_queue_node *tail;
-    size_t size;
-};
+#define WORK_QUEUE_MIN_CAPACITY 64
 
-struct _work_queue_node {
-    struct _work_queue_node *next;
+struct _work_queue_slot {
+    atomic_size_t sequence;
     struct work *data;
 };
 
+/*
+ * One power-of-two ring. Once full it is closed (tail gets
+ * WORK_QUEUE_CLOSED) and a ring twice its size takes over, the consumer
+ * drains it and moves on. The consumer frees the rings it moved past
+ * once no enqueue is in flight, a producer may still be looking at one
+ * it lost the race for until then.
+ */
+struct _work_queue_ring {
+    _Atomic(struct _work_queue_ring *) next;
+    size_t capacity;
+    atomic_size_t tail;
+    /* only the consumer touches it */
+    size_t head;
+    struct _work_queue_slot slots[];
+};
+
+#define WORK_QUEUE_CLOSED ((size_t) 1 << (sizeof(size_t) * 8 - 1))
+
+/*
+ * Queue of work made of growing rings.
+ * Any thread may enqueue (lock-free, a single CAS unless a ring fills),
+ * only the owning thread may look at the front and dequeue, it never
+ * writes anything producers read besides the slot sequence.
+ * A zeroed queue is valid and empty, storage is allocated on first use.
+ */
+struct work_queue {
+    /* oldest ring, the chain from it holds every ring */
+    _Atomic(struct _work_queue_ring *) first;
+    /* where producers enqueue */
+    _Atomic(struct _work_queue_ring *) last;
+    /* where the consumer reads, owner only */
+    struct _work_queue_ring *current;
+    /* enqueues that may still hold a ring they loaded from last */
+    atomic_size_t producers;
+};
+
 void work_queue_cleanup(struct work_queue *queue);
 int work_queue_enqueue(struct work_queue *queue, struct work *value);
 void work_queue_dequeue(struct work_queue *queue);
 struct work *work_queue_front(struct work_queue *queue);
-struct work *work_queue_back(struct work_queue *queue);
+size_t work_queue_size(struct work_queue *queue);
@@ -1,14 +1,22 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 
+#include <stdint.h>
 #include <work/work.h>
 #include <work/queue.h>
 #include <unuv.h>
 
 struct work_scheduler {
-    struct work_queue queue;
+    struct work_queue queues[WORK_PRIORITY_COUNT];
     un_loop *loop;
+    /* main thread time a single run may spend, 0 means no limit */
+    uint64_t budget_us;
 };
 
 void work_scheduler_add_work(struct work_scheduler *sched, struct work *work);
+void work_scheduler_set_budget(struct work_scheduler *sched, uint64_t budget_us);
+/* cancels the work of token submitted to sched, a token of another scheduler is left alone */
+void work_scheduler_cancel(struct work_scheduler *sched, struct work_token *token);
 void work_scheduler_run(struct work_scheduler *sched);
+/* frees the queues once the loop has stopped, work still queued is dropped */
+void work_scheduler_cleanup(struct work_scheduler *sched);
@@ -1,24 +1,74 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <unuv.h>
 #include <uv.h>
 
 struct work;
+struct work_scheduler;
 
 typedef void (*work_fn)(struct work *work);
 typedef void (*work_done)(struct work *work);
 
+/* lower runs first */
+enum work_priority {
+    WORK_PRIORITY_INTERACTIVE,
+    WORK_PRIORITY_LOAD,
+    WORK_PRIORITY_BACKGROUND,
+    WORK_PRIORITY_COUNT,
+};
+
+/*
+ * Shared by every piece of work one owner (a model reader, ...) submits,
+ * cancelling it cancels all of them at once.
+ */
+struct work_token {
+    atomic_bool cancelled;
+    /* the scheduler the work went to, only that one may cancel it */
+    struct work_scheduler *sched;
+};
+
+/*
+ * Work may depend on other work, it is held back by the scheduler until
+ * everything it depends on has finished. Either callback may be NULL.
+ * The scheduler owns submitted work and frees it once finished returns.
+ */
 struct work {
     work_fn perform;
     work_done finished;
     uv_work_t req;
     void *ctx;
+    struct work_token *token;
+    enum work_priority priority;
     bool thread_safe;
+
+    /* dependency graph, only touched on the main thread */
+    struct work_scheduler *sched;
+    struct work **dependents;
+    size_t dependent_count;
+    size_t dependent_capacity;
+    int unmet;
 };
 
 struct work *work_new(work_fn perform, work_done when_finished, bool run_on_thread);
 void work_set_context(struct work *work, void *context);
+void work_set_priority(struct work *work, enum work_priority priority);
+void work_set_token(struct work *work, struct work_token *token);
+
+/*
+ * work will not start before dependency has finished, dependency must
+ * not have finished yet. Declare edges before submitting work.
+ */
+void work_depends_on(struct work *work, struct work *dependency);
+
+/*
+ * Cancelled work skips perform, finished is still called so the owner
+ * can release what it holds. perform may poll this to bail out early.
+ */
+bool work_cancelled(struct work *work);
+void work_token_cancel(struct work_token *token);
 
 void work_evaluate(struct work *work, un_loop *loop);
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/capture.h>
+#include <core/microphone.h>
+#include <uv.h>
+
+static void capture_data(ma_device *device, void *output, const void *input,
+    ma_uint32 frame_count);
+
+int capture_start(struct microphone_data *mic)
+{
+    ma_device_config config = ma_device_config_init(ma_device_type_capture);
+    config.capture.format = ma_format_f32;
+    config.capture.channels = 1;
+    config.sampleRate = mic->config.native_rate ? 0 : CAPTURE_DEFAULT_RATE;
+    config.dataCallback = capture_data;
+    config.pUserData = mic;
+
+    if (mic->config.low_latency) {
+        config.performanceProfile = ma_performance_profile_low_latency;
+        config.periodSizeInFrames = mic->config.period_frames;
+        config.periods = mic->config.periods;
+    }
+
+    if (ma_device_init(NULL, &config, &mic->device) != MA_SUCCESS)
+        return 1;
+
+    /* the callback is not running yet, nothing else touches these */
+    uint32_t rate = mic->device.sampleRate;
+    level_meter_init(&mic->meter, rate);
+    vad_init(&mic->vad, rate);
+    atomic_store(&mic->ring.head, 0);
+    atomic_store(&mic->ring.tail, 0);
+
+    if (viseme_start(&mic->viseme, &mic->vad, rate)) {
+        ma_device_uninit(&mic->device);
+        return 1;
+    }
+
+    if (ma_device_start(&mic->device) != MA_SUCCESS) {
+        ma_device_uninit(&mic->device);
+        viseme_stop(&mic->viseme);
+        return 1;
+    }
+
+    mic->running = true;
+    return 0;
+}
+
+void capture_stop(struct microphone_data *mic)
+{
+    if (!mic->running)
+        return;
+
+    ma_device_uninit(&mic->device);
+    viseme_stop(&mic->viseme);
+    mic->running = false;
+}
+
+int capture_restart(struct microphone_data *mic)
+{
+    capture_stop(mic);
+    return capture_start(mic);
+}
+
+float capture_buffer_latency(struct microphone_data *mic)
+{
+    if (!mic->running || mic->device.capture.internalSampleRate == 0)
+        return 0.0f;
+
+    return mic->device.capture.internalPeriodSizeInFrames *
+        mic->device.capture.internalPeriods * 1000.0f /
+        mic->device.capture.internalSampleRate;
+}
+
+static void capture_data(ma_device *device, void *output, const void *input,
+    ma_uint32 frame_count)
+{
+    struct microphone_data *mic = device->pUserData;
+    struct level_snapshot level = level_meter_process(&mic->meter, input,
+        frame_count);
+    vad_process(&mic->vad, input, frame_count);
+    viseme_feed(&mic->viseme, input, frame_count);
+
+    struct level_frame frame = {
+        .time = uv_hrtime(),
+        .position = level.samples,
+        .rms = level.rms,
+        .peak = level.peak,
+    };
+    frame.talking = vad_read(&mic->vad, &frame.since);
+    level_ring_push(&mic->ring, &frame);
+}
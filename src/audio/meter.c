@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/meter.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static float follow(float envelope, float level, float seconds);
+
+void level_meter_init(struct level_meter *m, uint32_t sample_rate)
+{
+    memset(m, 0, sizeof(struct level_meter));
+    m->sample_rate = sample_rate;
+}
+
+struct level_snapshot level_meter_process(struct level_meter *m,
+    const float *samples, size_t count)
+{
+    if (count == 0)
+        return level_meter_read(m);
+
+    float sum, peak;
+    level_measure(samples, count, &sum, &peak);
+
+    float rms = sqrtf(sum / count);
+    m->current_envelope = follow(m->current_envelope, rms,
+        count / m->sample_rate);
+    m->total += count;
+
+    unsigned sequence = atomic_load_explicit(&m->sequence, memory_order_relaxed);
+    atomic_store_explicit(&m->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&m->rms, rms, memory_order_relaxed);
+    atomic_store_explicit(&m->peak, peak, memory_order_relaxed);
+    atomic_store_explicit(&m->envelope, m->current_envelope, memory_order_relaxed);
+    atomic_store_explicit(&m->samples, m->total, memory_order_relaxed);
+
+    atomic_store_explicit(&m->sequence, sequence + 2, memory_order_release);
+
+    return (struct level_snapshot) {
+        .rms = rms,
+        .peak = peak,
+        .envelope = m->current_envelope,
+        .samples = m->total,
+    };
+}
+
+struct level_snapshot level_meter_read(struct level_meter *m)
+{
+    struct level_snapshot s;
+    unsigned sequence;
+
+    /* retry while the audio thread is in the middle of a block */
+    do {
+        sequence = atomic_load_explicit(&m->sequence, memory_order_acquire);
+
+        s.rms = atomic_load_explicit(&m->rms, memory_order_relaxed);
+        s.peak = atomic_load_explicit(&m->peak, memory_order_relaxed);
+        s.envelope = atomic_load_explicit(&m->envelope, memory_order_relaxed);
+        s.samples = atomic_load_explicit(&m->samples, memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) ||
+        sequence != atomic_load_explicit(&m->sequence, memory_order_relaxed));
+
+    return s;
+}
+
+void level_measure(const float *samples, size_t count, float *sum, float *peak)
+{
+    size_t i = 0;
+    float s = 0.0f;
+    float p = 0.0f;
+
+#if defined(__AVX2__)
+    __m256 sum8 = _mm256_setzero_ps();
+    __m256 peak8 = _mm256_setzero_ps();
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(samples + i);
+        sum8 = _mm256_add_ps(sum8, _mm256_mul_ps(v, v));
+        peak8 = _mm256_max_ps(peak8, _mm256_andnot_ps(sign, v));
+    }
+
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum8),
+        _mm256_extractf128_ps(sum8, 1));
+    __m128 peak4 = _mm_max_ps(_mm256_castps256_ps128(peak8),
+        _mm256_extractf128_ps(peak8, 1));
+#elif defined(__SSE2__)
+    __m128 sum4 = _mm_setzero_ps();
+    __m128 peak4 = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(samples + i);
+        sum4 = _mm_add_ps(sum4, _mm_mul_ps(v, v));
+        peak4 = _mm_max_ps(peak4, _mm_andnot_ps(sign, v));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t sum4 = vdupq_n_f32(0.0f);
+    float32x4_t peak4 = vdupq_n_f32(0.0f);
+
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t v = vld1q_f32(samples + i);
+        sum4 = vmlaq_f32(sum4, v, v);
+        peak4 = vmaxq_f32(peak4, vabsq_f32(v));
+    }
+
+    float lanes[4], peaks[4];
+    vst1q_f32(lanes, sum4);
+    vst1q_f32(peaks, peak4);
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    float lanes[4], peaks[4];
+    _mm_storeu_ps(lanes, sum4);
+    _mm_storeu_ps(peaks, peak4);
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__ARM_NEON)
+    s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    p = fmaxf(fmaxf(peaks[0], peaks[1]), fmaxf(peaks[2], peaks[3]));
+#endif
+
+    /* what is left after the last full vector, or everything without SIMD */
+    for (; i < count; i++) {
+        s += samples[i] * samples[i];
+        p = fmaxf(p, fabsf(samples[i]));
+    }
+
+    *sum = s;
+    *peak = p;
+}
+
+/* one pole follower over a block lasting seconds */
+static float follow(float envelope, float level, float seconds)
+{
+    float time = level > envelope ? METER_ATTACK : METER_RELEASE;
+    float keep = expf(-seconds / time);
+    return level + (envelope - level) * keep;
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/ring.h>
+#include <string.h>
+
+bool level_ring_push(struct level_ring *r, const struct level_frame *frame)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail == LEVEL_RING_SIZE)
+        return false;
+
+    r->frames[head & (LEVEL_RING_SIZE - 1)] = *frame;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool level_ring_pop(struct level_ring *r, struct level_frame *frame)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+
+    *frame = r->frames[tail & (LEVEL_RING_SIZE - 1)];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+size_t sample_ring_write(struct sample_ring *r, const float *samples,
+    size_t count)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t space = SAMPLE_RING_SIZE - (head - tail);
+
+    if (count > space)
+        count = space;
+
+    /* at most two copies, before and after the wrap */
+    size_t start = head & (SAMPLE_RING_SIZE - 1);
+    size_t first = SAMPLE_RING_SIZE - start;
+    if (first > count)
+        first = count;
+
+    memcpy(r->samples + start, samples, first * sizeof(float));
+    memcpy(r->samples, samples + first, (count - first) * sizeof(float));
+    atomic_store_explicit(&r->head, head + count, memory_order_release);
+    return count;
+}
+
+bool sample_ring_read(struct sample_ring *r, float *samples, size_t count)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (head - tail < count)
+        return false;
+
+    size_t start = tail & (SAMPLE_RING_SIZE - 1);
+    size_t first = SAMPLE_RING_SIZE - start;
+    if (first > count)
+        first = count;
+
+    memcpy(samples, r->samples + start, first * sizeof(float));
+    memcpy(samples + first, r->samples, (count - first) * sizeof(float));
+    atomic_store_explicit(&r->tail, tail + count, memory_order_release);
+    return true;
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/spectrum.h>
+#include <math.h>
+#include <string.h>
+
+#define SPECTRUM_BITS 9
+#define TAU 6.28318531f
+
+void spectrum_init(struct spectrum *s, uint32_t sample_rate)
+{
+    memset(s, 0, sizeof(struct spectrum));
+    s->bin_hz = (float) sample_rate / SPECTRUM_SIZE;
+
+    for (int i = 0; i < SPECTRUM_SIZE; i++) {
+        s->window[i] = 0.5f - 0.5f * cosf(TAU * i / SPECTRUM_SIZE);
+
+        int reversed = 0;
+        for (int bit = 0; bit < SPECTRUM_BITS; bit++)
+            reversed |= ((i >> bit) & 1) << (SPECTRUM_BITS - 1 - bit);
+        s->reverse[i] = reversed;
+    }
+
+    for (int i = 0; i < SPECTRUM_SIZE / 2; i++) {
+        s->cos[i] = cosf(TAU * i / SPECTRUM_SIZE);
+        s->sin[i] = -sinf(TAU * i / SPECTRUM_SIZE);
+    }
+}
+
+const float *spectrum_power(struct spectrum *s, const float *samples)
+{
+    for (int i = 0; i < SPECTRUM_SIZE; i++) {
+        s->re[s->reverse[i]] = samples[i] * s->window[i];
+        s->im[s->reverse[i]] = 0.0f;
+    }
+
+    for (int half = 1; half < SPECTRUM_SIZE; half *= 2) {
+        int step = SPECTRUM_SIZE / (half * 2);
+
+        for (int start = 0; start < SPECTRUM_SIZE; start += half * 2) {
+            for (int k = 0; k < half; k++) {
+                int a = start + k;
+                int b = a + half;
+                float wr = s->cos[k * step];
+                float wi = s->sin[k * step];
+                float tr = s->re[b] * wr - s->im[b] * wi;
+                float ti = s->re[b] * wi + s->im[b] * wr;
+
+                s->re[b] = s->re[a] - tr;
+                s->im[b] = s->im[a] - ti;
+                s->re[a] += tr;
+                s->im[a] += ti;
+            }
+        }
+    }
+
+    for (int i = 0; i < SPECTRUM_BINS; i++)
+        s->power[i] = s->re[i] * s->re[i] + s->im[i] * s->im[i];
+
+    return s->power;
+}
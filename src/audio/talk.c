@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/talk.h>
+#include <string.h>
+
+void talk_fsm_init(struct talk_fsm *f)
+{
+    memset(f, 0, sizeof(struct talk_fsm));
+    f->state = TALK_QUIET;
+}
+
+void talk_fsm_step(struct talk_fsm *f, bool voiced, uint64_t since,
+    uint64_t now, uint32_t ttl)
+{
+    if (voiced) {
+        f->voiced = true;
+        f->state = TALK_TALKING;
+        return;
+    }
+
+    if (f->voiced) {
+        f->voiced = false;
+        f->stopped_at = since;
+    }
+
+    if (f->state == TALK_TALKING && now >= f->stopped_at + ttl / 2)
+        f->state = TALK_PAUSED;
+
+    if (f->state == TALK_PAUSED && now >= f->stopped_at + ttl)
+        f->state = TALK_QUIET;
+}
+
+mask_t talk_fsm_apply(const struct talk_fsm *f, mask_t mask)
+{
+    mask &= ~(mask_t) (QUIET | TALK | PAUSE);
+
+    switch (f->state) {
+    case TALK_QUIET:
+        return mask | QUIET;
+    case TALK_TALKING:
+        /* talking layers and pause layers both show while talking */
+        return mask | TALK | PAUSE;
+    case TALK_PAUSED:
+        return mask | PAUSE;
+    }
+
+    return mask | QUIET;
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/vad.h>
+#include <math.h>
+#include <string.h>
+
+static void biquad_init(struct biquad *f, float sample_rate, float hz, bool high);
+static float biquad_run(struct biquad *f, float x);
+static void end_window(struct vad *v);
+static void publish(struct vad *v, bool talking);
+
+void vad_init(struct vad *v, uint32_t sample_rate)
+{
+    memset(v, 0, sizeof(struct vad));
+    v->sample_rate = sample_rate;
+    v->window = sample_rate * VAD_WINDOW_MS / 1000;
+    v->hangover = sample_rate * VAD_HANGOVER_MS / 1000;
+    biquad_init(&v->highpass, sample_rate, VAD_LOW_HZ, true);
+    biquad_init(&v->lowpass, sample_rate, VAD_HIGH_HZ, false);
+}
+
+void vad_process(struct vad *v, const float *samples, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        float x = biquad_run(&v->lowpass, biquad_run(&v->highpass, samples[i]));
+        v->window_sum += x * x;
+        v->position++;
+
+        if (++v->window_fill == v->window)
+            end_window(v);
+    }
+}
+
+void vad_set_gate(struct vad *v, float gate)
+{
+    atomic_store_explicit(&v->gate, gate, memory_order_relaxed);
+}
+
+bool vad_read(struct vad *v, uint64_t *since)
+{
+    uint64_t state = atomic_load_explicit(&v->state, memory_order_acquire);
+    if (since != NULL)
+        *since = state >> 1;
+
+    return state & 1;
+}
+
+static void end_window(struct vad *v)
+{
+    float rms = sqrtf(v->window_sum / v->window);
+    float gate = atomic_load_explicit(&v->gate, memory_order_relaxed);
+    v->window_sum = 0.0f;
+    v->window_fill = 0;
+
+    /* the floor follows drops at once and creeps up otherwise, pauses
+     * between words pull it back down while talking */
+    if (rms < v->noise_floor || v->noise_floor == 0.0f)
+        v->noise_floor = rms;
+    else
+        v->noise_floor *= powf(VAD_FLOOR_RISE, VAD_WINDOW_MS / 1000.0f);
+
+    bool voiced = rms > gate && rms > v->noise_floor * VAD_MARGIN;
+
+    if (voiced) {
+        v->hangover_left = v->hangover;
+        if (!v->talking && ++v->onset >= VAD_ONSET_WINDOWS)
+            publish(v, true);
+        return;
+    }
+
+    v->onset = 0;
+    if (!v->talking)
+        return;
+
+    if (v->hangover_left > v->window)
+        v->hangover_left -= v->window;
+    else
+        publish(v, false);
+}
+
+static void publish(struct vad *v, bool talking)
+{
+    v->talking = talking;
+    v->onset = 0;
+    atomic_store_explicit(&v->state, v->position << 1 | talking,
+        memory_order_release);
+}
+
+/* RBJ cookbook, Butterworth Q */
+static void biquad_init(struct biquad *f, float sample_rate, float hz, bool high)
+{
+    float w = 2.0f * 3.14159265f * hz / sample_rate;
+    float alpha = sinf(w) / (2.0f * 0.70710678f);
+    float c = cosf(w);
+    float a0 = 1.0f + alpha;
+
+    float b1 = high ? -(1.0f + c) : 1.0f - c;
+    float b0 = high ? (1.0f + c) / 2.0f : (1.0f - c) / 2.0f;
+
+    memset(f, 0, sizeof(struct biquad));
+    f->b0 = b0 / a0;
+    f->b1 = b1 / a0;
+    f->b2 = b0 / a0;
+    f->a1 = -2.0f * c / a0;
+    f->a2 = (1.0f - alpha) / a0;
+}
+
+/* transposed direct form II */
+static float biquad_run(struct biquad *f, float x)
+{
+    float y = f->b0 * x + f->z1;
+    f->z1 = f->b1 * x - f->a1 * y + f->z2;
+    f->z2 = f->b2 * x - f->a2 * y;
+    return y;
+}
@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <audio/viseme.h>
+#include <math.h>
+#include <string.h>
+
+#define TAU 6.28318531f
+/* cost smoothing, about the last 20 hops */
+#define COST_SMOOTHING 0.05f
+
+static void analyze(void *data);
+static void analyze_hop(struct viseme_analyzer *a);
+static void formants(const struct viseme_classifier *c, const float *power,
+    float *f1, float *f2);
+
+void viseme_classifier_init(struct viseme_classifier *c, float bin_hz)
+{
+    memset(c, 0, sizeof(struct viseme_classifier));
+    c->bin_hz = bin_hz;
+    c->bins = VISEME_BAND_HZ / bin_hz;
+    if (c->bins > SPECTRUM_BINS - 1)
+        c->bins = SPECTRUM_BINS - 1;
+
+    for (int k = 0; k <= c->bins; k++) {
+        float emphasis = 1.0f + k * bin_hz / VISEME_EMPHASIS_HZ;
+        c->weight[k] = emphasis * emphasis;
+        /* trapezoid ends, the band is treated as a whole spectrum */
+        if (k == 0 || k == c->bins)
+            c->weight[k] *= 0.5f;
+
+        /* bins of the band as the frequencies of a signal sampled at twice its edge */
+        for (int m = 0; m <= VISEME_ORDER; m++) {
+            c->cos[m][k] = cosf(TAU / 2 * m * k / c->bins);
+            c->sin[m][k] = sinf(TAU / 2 * m * k / c->bins);
+        }
+    }
+}
+
+enum viseme viseme_classify(const struct viseme_classifier *c,
+    const float *power)
+{
+    float f1, f2;
+    formants(c, power, &f1, &f2);
+
+    if (f1 == 0.0f)
+        return VISEME_CLOSED;
+    if (f2 >= VISEME_WIDE_F2)
+        return VISEME_WIDE;
+    if (f1 + f2 >= VISEME_OPEN_SUM)
+        return VISEME_OPEN;
+
+    return VISEME_ROUND;
+}
+
+int viseme_start(struct viseme_analyzer *a, struct vad *vad,
+    uint32_t sample_rate)
+{
+    atomic_store(&a->ring.head, 0);
+    atomic_store(&a->ring.tail, 0);
+    atomic_store(&a->viseme, VISEME_CLOSED);
+    atomic_store(&a->cost, 0.0f);
+    atomic_store(&a->quit, false);
+
+    a->vad = vad;
+    a->hop_ms = VISEME_HOP * 1000.0f / sample_rate;
+    spectrum_init(&a->spectrum, sample_rate);
+    viseme_classifier_init(&a->classifier, a->spectrum.bin_hz);
+    memset(a->block, 0, sizeof(a->block));
+    a->candidate = VISEME_CLOSED;
+    a->candidate_hops = 0;
+
+    if (uv_sem_init(&a->fed, 0) != 0)
+        return 1;
+
+    if (uv_thread_create(&a->thread, analyze, a) != 0) {
+        uv_sem_destroy(&a->fed);
+        return 1;
+    }
+
+    a->running = true;
+    return 0;
+}
+
+void viseme_stop(struct viseme_analyzer *a)
+{
+    if (!a->running)
+        return;
+
+    atomic_store(&a->quit, true);
+    uv_sem_post(&a->fed);
+    uv_thread_join(&a->thread);
+    uv_sem_destroy(&a->fed);
+    atomic_store(&a->viseme, VISEME_CLOSED);
+    a->running = false;
+}
+
+void viseme_feed(struct viseme_analyzer *a, const float *samples,
+    size_t count)
+{
+    sample_ring_write(&a->ring, samples, count);
+    /* a futex wake at most, never blocks */
+    uv_sem_post(&a->fed);
+}
+
+enum viseme viseme_read(struct viseme_analyzer *a)
+{
+    return atomic_load_explicit(&a->viseme, memory_order_relaxed);
+}
+
+static void analyze(void *data)
+{
+    struct viseme_analyzer *a = data;
+    float *hop = a->block + SPECTRUM_SIZE - VISEME_HOP;
+
+    while (!atomic_load(&a->quit)) {
+        if (!sample_ring_read(&a->ring, hop, VISEME_HOP)) {
+            uv_sem_wait(&a->fed);
+            continue;
+        }
+
+        uint64_t start = uv_hrtime();
+        analyze_hop(a);
+        float cost = (uv_hrtime() - start) / 1e3f;
+        float smoothed = atomic_load_explicit(&a->cost, memory_order_relaxed);
+        atomic_store_explicit(&a->cost,
+            smoothed + (cost - smoothed) * COST_SMOOTHING, memory_order_relaxed);
+
+        memmove(a->block, a->block + VISEME_HOP,
+            (SPECTRUM_SIZE - VISEME_HOP) * sizeof(float));
+    }
+}
+
+static void analyze_hop(struct viseme_analyzer *a)
+{
+    enum viseme shape = VISEME_CLOSED;
+
+    /* the spectrum of silence is noise, no use for a shape */
+    if (vad_read(a->vad, NULL))
+        shape = viseme_classify(&a->classifier,
+            spectrum_power(&a->spectrum, a->block));
+
+    if (shape != a->candidate) {
+        a->candidate = shape;
+        a->candidate_hops = 0;
+    }
+
+    if (++a->candidate_hops == VISEME_HOLD)
+        atomic_store_explicit(&a->viseme, shape, memory_order_relaxed);
+}
+
+/* first two peaks of the LPC envelope of the emphasised band, 0 if missing */
+static void formants(const struct viseme_classifier *c, const float *power,
+    float *f1, float *f2)
+{
+    float r[VISEME_ORDER + 1];
+    float lpc[VISEME_ORDER + 1] = { 1.0f };
+    float previous[VISEME_ORDER + 1];
+
+    for (int m = 0; m <= VISEME_ORDER; m++) {
+        float sum = 0.0f;
+        for (int k = 0; k <= c->bins; k++)
+            sum += c->weight[k] * power[k] * c->cos[m][k];
+        r[m] = sum;
+    }
+
+    *f1 = 0.0f;
+    *f2 = 0.0f;
+    if (r[0] <= 0.0f)
+        return;
+
+    /* Levinson-Durbin, a tiny white floor keeps it stable */
+    float error = r[0] * 1.0001f;
+    for (int i = 1; i <= VISEME_ORDER; i++) {
+        float sum = r[i];
+        for (int j = 1; j < i; j++)
+            sum += lpc[j] * r[i - j];
+
+        float k = -sum / error;
+        memcpy(previous, lpc, sizeof(lpc));
+        for (int j = 1; j < i; j++)
+            lpc[j] = previous[j] + k * previous[i - j];
+        lpc[i] = k;
+        error *= 1.0f - k * k;
+    }
+
+    /* the envelope is 1 / |A|^2, its peaks are the minima of |A|^2 */
+    float before = INFINITY, current = INFINITY;
+    int found = 0;
+
+    for (int k = 0; k <= c->bins && found < 2; k++) {
+        float re = 0.0f, im = 0.0f;
+        for (int j = 0; j <= VISEME_ORDER; j++) {
+            re += lpc[j] * c->cos[j][k];
+            im -= lpc[j] * c->sin[j][k];
+        }
+
+        float next = re * re + im * im;
+        if (k >= 2 && current < before && current <= next) {
+            /* vertex of the parabola through the three, bins are coarse */
+            float offset = 0.5f * (before - next) / (before - 2.0f * current + next);
+            float hz = (k - 1 + offset) * c->bin_hz;
+
+            if (hz >= VISEME_F1_MIN_HZ) {
+                if (found++ == 0)
+                    *f1 = hz;
+                else
+                    *f2 = hz;
+            }
+        }
+
+        before = current;
+        current = next;
+    }
+}
@@ -61,6 +61,8 @@ void context_load_image(struct context *ctx, const char *name,
 
     if (strcmp(req->ext, ".gif") == 0)
         req->gif_buffer = malloc(size);
+    else if (strcmp(req->ext, ".png") == 0)
+        req->png_buffer = malloc(size);
 
     req->req.data = req;
     uv_queue_work((uv_loop_t*) ctx->loop, &req->req, work, after);
@@ -124,9 +126,12 @@ void context_after_img_load(struct context *ctx, struct image_load_req *req)
     if (req->gif_buffer != NULL)
         layer = layer_new_animated(req->img, req->frames_count,
             req->gif_buffer, req->size, req->delays);
-    else
+    else {
         layer = layer_new(req->img);
-    
+        if (req->png_buffer != NULL)
+            layer_set_encoded(layer, req->png_buffer, req->size);
+    }
+
     LOG_I("Loaded layer \"%s\"", req->name);
     layer_override_name(layer, req->name);
 
@@ -134,7 +139,7 @@ void context_after_img_load(struct context *ctx, struct image_load_req *req)
 
     if (layer->properties.is_animated) {
         anim_layer = layer_get_animated(layer);
-        layer_animated_start(anim_layer, ctx->loop);                
+        layer_animated_start(anim_layer);
     }
 
     /* cleanup */
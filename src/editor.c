@@ -17,12 +17,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+
+/* no capture block for this long and the voice counts as gone */
+#define CAPTURE_STALL_MS 100
 
 extern struct context ctx;
 
-static enum un_action update_talk_mask(un_timer *timer);
-static enum un_action update_pause_mask(un_timer *timer);
 static void hex_str_to_color(const char *str, Color *color);
+static size_t mic_volume(struct microphone_data *mic);
+static void draw_capture(struct editor *editor, struct nk_context *ctx);
 
 void editor_draw(struct editor *editor, struct nk_context *ctx, bool *ui_focused)
 {
@@ -163,17 +167,17 @@ void editor_draw_stream(struct editor *editor, struct nk_context *ctx,
             case MICROPHONE:
                 nk_layout_row_dynamic(ctx, 30, 1);
                 nk_label(ctx, "Microphone Volume: ", NK_TEXT_LEFT);
-                size_t volume = atomic_load(&editor->mic->volume);
+                size_t volume = mic_volume(editor->mic);
                 volume = Lerp(volume, editor->previous_volume, 0.75);
 
-                int percentage = (volume * 100) / 200;
+                bool talking = vad_read(&editor->mic->vad, NULL);
 
-                if (percentage > editor->microphone_trigger)
+                if (talking)
                     nk_style_push_color(ctx, &ctx->style.progress.cursor_normal.data.color, nk_rgb(0xFF, 0, 0));
 
                 nk_progress(ctx, &volume, 200, false);
 
-                if (percentage > editor->microphone_trigger)
+                if (talking)
                     nk_style_pop_color(ctx);
 
                 nk_label(ctx, "Microphone Sensitivity: ", NK_TEXT_LEFT);
@@ -184,6 +188,8 @@ void editor_draw_stream(struct editor *editor, struct nk_context *ctx,
                 nk_label(ctx, "Microphone Trigger: ", NK_TEXT_LEFT);
                 nk_progress(ctx, &editor->microphone_trigger, 100, true);
 
+                draw_capture(editor, ctx);
+
                 editor->previous_volume = volume;
                 break;
             case SCENE:
@@ -205,6 +211,9 @@ void editor_draw_stream(struct editor *editor, struct nk_context *ctx,
                     hex_str_to_color(editor->bg_color_in,
                         &editor->background_color);
                 }
+
+                nk_checkbox_label(ctx, "Only redraw on changes",
+                    &editor->render_skip);
                 break;
             }
 
@@ -219,69 +228,107 @@ void editor_draw_stream(struct editor *editor, struct nk_context *ctx,
 
 void editor_apply_mask(struct editor *editor)
 {
-    size_t volume = atomic_load(&editor->mic->volume);
-    volume = Lerp(volume, editor->previous_volume, 0.75);
-
-    int percentage = (volume * 100) / 200;
+    struct microphone_data *mic = editor->mic;
+    int multiplier = atomic_load(&mic->multiplier);
     mask_t mask = get_current_mask();
 
-    if (percentage > editor->microphone_trigger) {
-        mask &= ~QUIET;
-        if (!editor->talk_timer_running) {
-            mask |= TALK;
-            un_timer *timer = un_timer_new(ctx.loop);
-            un_timer_set_data(timer, editor);
-            int delay = editor->timer_ttl / 2;
-            un_timer_start(timer, delay, delay, update_talk_mask);
-            editor->talk_timer_running = true;
-        }
+    /* the trigger in band RMS, same scale the volume bar uses */
+    vad_set_gate(&mic->vad, multiplier > 0 ?
+        editor->microphone_trigger * 2.0f / multiplier : INFINITY);
 
-        if (!editor->pause_timer_running) {
-            mask |= PAUSE;
-            un_timer *timer = un_timer_new(ctx.loop);
-            un_timer_set_data(timer, editor);
-            int delay = editor->timer_ttl;
-            un_timer_start(timer, delay, delay, update_pause_mask);
-            editor->pause_timer_running = true;
-        }
+    /* every block since the last frame in order, a syllable between frames counts */
+    struct level_frame frame;
+    uint32_t rate = mic->device.sampleRate;
+    uint64_t now = uv_hrtime();
+
+    while (level_ring_pop(&mic->ring, &frame)) {
+        editor->capture_delay = Lerp(editor->capture_delay,
+            (now - frame.time) / 1e6f, 0.05f);
+
+        if (rate == 0)
+            continue;
+
+        /* captured audio is the clock, milliseconds since capture started */
+        editor->talk_clock = frame.position * 1000 / rate;
+        editor->talk_clock_time = frame.time;
+        talk_fsm_step(&editor->talk, frame.talking, frame.since * 1000 / rate,
+            editor->talk_clock, editor->timer_ttl);
     }
-    set_current_mask(mask);
-}
 
-static enum un_action update_talk_mask(un_timer *timer)
-{
-    struct editor *ed = un_timer_get_data(timer);
-    un_timer_set_repeat(timer, ed->timer_ttl / 2);
+    /*
+     * Nothing captured for a while, the device stalled or went away. The
+     * clock runs on from the last block and the voice stops where it ended,
+     * so the model still pauses and goes quiet.
+     */
+    if (editor->talk_clock_time != 0 && now > editor->talk_clock_time) {
+        uint64_t stalled = (now - editor->talk_clock_time) / 1000000;
+        if (stalled > CAPTURE_STALL_MS)
+            talk_fsm_step(&editor->talk, false, editor->talk_clock,
+                editor->talk_clock + stalled, editor->timer_ttl);
+    }
 
-    int percentage = (ed->previous_volume * 100) / 200;
-    if (percentage > ed->microphone_trigger)
-        return REARM;
+    mask = talk_fsm_apply(&editor->talk, mask);
 
-    ed->talk_timer_running = false;
-    mask_t mask = get_current_mask();
-    mask &= ~TALK;
+    /* one mouth shape at a time, closed while nothing is captured */
+    mask &= ~VISEMES;
+    mask |= 1ULL << (viseme_read(&mic->viseme) + VISEME_START);
     set_current_mask(mask);
-
-    return DISARM;
 }
 
-static enum un_action update_pause_mask(un_timer *timer)
+/* RMS scaled by the sensitivity, the meter keeps the float */
+static size_t mic_volume(struct microphone_data *mic)
 {
-    struct editor *ed = un_timer_get_data(timer);
-    un_timer_set_repeat(timer, ed->timer_ttl);
-
-    int percentage = (ed->previous_volume * 100) / 200;
-    if (percentage > ed->microphone_trigger)
-        return REARM;
+    struct level_snapshot level = level_meter_read(&mic->meter);
+    return level.rms * atomic_load(&mic->multiplier);
+}
 
-    ed->pause_timer_running = false;
-    mask_t mask = get_current_mask();
-    mask |= QUIET;
-    mask &= ~PAUSE;
-    mask &= ~TALK;
-    set_current_mask(mask);
+static void draw_capture(struct editor *editor, struct nk_context *ctx)
+{
+    struct microphone_data *mic = editor->mic;
+    struct capture_config *config = &mic->config;
+
+    nk_label(ctx, "Capture: ", NK_TEXT_LEFT);
+    nk_layout_row_dynamic(ctx, 30, 2);
+    nk_checkbox_label(ctx, "Low latency", &config->low_latency);
+    nk_checkbox_label(ctx, "Native sample rate", &config->native_rate);
+
+    if (!config->low_latency)
+        nk_widget_disable_begin(ctx);
+
+    nk_property_int(ctx, "Period frames:", 16, &config->period_frames, 4096, 16, 1);
+    nk_property_int(ctx, "Periods:", 2, &config->periods, 8, 1, 0.1f);
+
+    if (!config->low_latency)
+        nk_widget_disable_end(ctx);
+
+    nk_layout_row_dynamic(ctx, 30, 1);
+    if (nk_button_label(ctx, "Apply")) {
+        /* sample positions start over with the device */
+        talk_fsm_init(&editor->talk);
+        if (capture_restart(mic)) {
+            LOG_E("Unable to capture with these settings, back to defaults", 0);
+            config->low_latency = false;
+            config->native_rate = false;
+            if (capture_start(mic))
+                LOG_E("Failed to start the microphone", 0);
+        }
+    }
 
-    return DISARM;
+    /* what the device holds plus how long a block takes to reach the frame */
+    float buffered = capture_buffer_latency(mic);
+    nk_labelf(ctx, NK_TEXT_LEFT, "Latency: %.1f ms (%.1f buffered, %.1f delivery)",
+        buffered + editor->capture_delay, buffered, editor->capture_delay);
+
+    if (mic->running)
+        nk_labelf(ctx, NK_TEXT_LEFT, "%u Hz, %u x %u frames",
+            mic->device.capture.internalSampleRate,
+            mic->device.capture.internalPeriods,
+            mic->device.capture.internalPeriodSizeInFrames);
+
+    const char *shapes[] = {"Closed", "Open", "Wide", "Round"};
+    nk_labelf(ctx, NK_TEXT_LEFT, "Mouth shape: %s (%.1f us a hop of %.1f ms)",
+        shapes[viseme_read(&mic->viseme)], atomic_load(&mic->viseme.cost),
+        mic->viseme.hop_ms);
 }
 
 static int hex_char_to_num(char c)
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <layer/composite.h>
+#include <rlgl.h>
+#include <math.h>
+#include <string.h>
+
+void layer_composite_extend(Rectangle *bounds, const struct layer_properties *props,
+    Vector2 anchor)
+{
+    float w = props->texture.width / 2.0f;
+    float h = props->texture.height / 2.0f;
+    float s = fabsf(sinf(props->rotation * DEG2RAD));
+    float c = fabsf(cosf(props->rotation * DEG2RAD));
+
+    /* half extents of the rotated texture around its center */
+    float ex = w * c + h * s;
+    float ey = w * s + h * c;
+    float cx = anchor.x + props->offset.x;
+    float cy = anchor.y - props->offset.y;
+
+    float x0 = floorf(cx - ex);
+    float y0 = floorf(cy - ey);
+    float x1 = ceilf(cx + ex);
+    float y1 = ceilf(cy + ey);
+
+    if (bounds->width > 0 && bounds->height > 0) {
+        x0 = fminf(x0, bounds->x);
+        y0 = fminf(y0, bounds->y);
+        x1 = fmaxf(x1, bounds->x + bounds->width);
+        y1 = fmaxf(y1, bounds->y + bounds->height);
+    }
+
+    *bounds = (Rectangle) { x0, y0, x1 - x0, y1 - y0 };
+}
+
+bool layer_composite_begin(struct layer_composite *c, Rectangle bounds,
+    Vector2 *anchor)
+{
+    if (bounds.width > COMPOSITE_MAX_SIZE || bounds.height > COMPOSITE_MAX_SIZE)
+        return false;
+
+    if (c->target.id == 0 || c->target.texture.width != (int) bounds.width ||
+        c->target.texture.height != (int) bounds.height) {
+        layer_composite_free(c);
+        c->target = LoadRenderTexture(bounds.width, bounds.height);
+        SetTextureFilter(c->target.texture, TEXTURE_FILTER_BILINEAR);
+    }
+
+    c->bounds = bounds;
+    anchor->x -= bounds.x;
+    anchor->y -= bounds.y;
+
+    BeginTextureMode(c->target);
+    ClearBackground(BLANK);
+    /* straight alpha layers over a premultiplied destination */
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE,
+        RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+    return true;
+}
+
+void layer_composite_end(struct layer_composite *c)
+{
+    EndBlendMode();
+    EndTextureMode();
+}
+
+void layer_composite_draw(const struct layer_composite *c)
+{
+    Texture2D texture = c->target.texture;
+
+    BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+    /* render textures are stored upside down */
+    DrawTexturePro(texture, (Rectangle) { 0, 0, texture.width, -texture.height },
+        c->bounds, (Vector2) { 0, 0 }, 0, WHITE);
+    EndBlendMode();
+}
+
+void layer_composite_free(struct layer_composite *c)
+{
+    if (c->target.id != 0)
+        UnloadRenderTexture(c->target);
+
+    memset(&c->target, 0, sizeof(RenderTexture2D));
+    c->key = 0;
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <layer/frames.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* open addressing, four times the palette keeps probes short */
+#define COLOR_TABLE_SIZE (INDEXED_PALETTE_SIZE * 4)
+
+struct color_slot {
+    uint32_t color;
+    int16_t index;
+};
+
+static bool index_frame(const uint8_t *rgba, size_t count, Color *palette,
+    uint8_t *indices, struct color_slot *table);
+
+bool indexed_frames_from_rgba(struct indexed_frames *f, const uint8_t *rgba,
+    int width, int height, size_t frame_count)
+{
+    size_t pixels = (size_t) width * height;
+    struct color_slot table[COLOR_TABLE_SIZE];
+
+    memset(f, 0, sizeof(struct indexed_frames));
+    f->width = width;
+    f->height = height;
+    f->frame_count = frame_count;
+    f->palettes = calloc(frame_count * INDEXED_PALETTE_SIZE, sizeof(Color));
+    f->indices = malloc(pixels * frame_count);
+
+    for (size_t i = 0; i < frame_count; i++) {
+        if (!index_frame(rgba + pixels * 4 * i, pixels,
+            f->palettes + INDEXED_PALETTE_SIZE * i, f->indices + pixels * i, table)) {
+            indexed_frames_free(f);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const uint8_t *indexed_frames_expand(struct indexed_frames *f, size_t frame)
+{
+    size_t pixels = (size_t) f->width * f->height;
+    const Color *palette = f->palettes + INDEXED_PALETTE_SIZE * frame;
+    const uint8_t *indices = f->indices + pixels * frame;
+
+    if (f->scratch == NULL)
+        f->scratch = malloc(pixels * 4);
+
+    Color *out = (Color*) f->scratch;
+    for (size_t i = 0; i < pixels; i++)
+        out[i] = palette[indices[i]];
+
+    return f->scratch;
+}
+
+size_t indexed_frames_size(const struct indexed_frames *f)
+{
+    return f->frame_count * ((size_t) f->width * f->height +
+        INDEXED_PALETTE_SIZE * sizeof(Color));
+}
+
+void indexed_frames_free(struct indexed_frames *f)
+{
+    free(f->palettes);
+    free(f->indices);
+    free(f->scratch);
+    memset(f, 0, sizeof(struct indexed_frames));
+}
+
+static bool index_frame(const uint8_t *rgba, size_t count, Color *palette,
+    uint8_t *indices, struct color_slot *table)
+{
+    int used = 0;
+
+    for (size_t i = 0; i < COLOR_TABLE_SIZE; i++)
+        table[i].index = -1;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t color;
+        memcpy(&color, rgba + i * 4, sizeof(color));
+        /* top bits of a multiplicative hash, the table is 2^10 */
+        size_t slot = (uint32_t) (color * 2654435761u) >> 22;
+
+        while (table[slot].index >= 0 && table[slot].color != color)
+            slot = (slot + 1) % COLOR_TABLE_SIZE;
+
+        if (table[slot].index < 0) {
+            if (used == INDEXED_PALETTE_SIZE)
+                return false;
+
+            table[slot].color = color;
+            table[slot].index = used;
+            memcpy(&palette[used], &color, sizeof(Color));
+            used++;
+        }
+
+        indices[i] = table[slot].index;
+    }
+
+    return true;
+}
@@ -0,0 +1,645 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <layer/gif.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GIF_HEADER_SIZE 13
+/* stb_image gives up on a frame once its code table would grow past this */
+#define GIF_CODE_LIMIT 8192
+
+struct bit_reader {
+    const struct gif_decoder *decoder;
+    size_t pos;
+    size_t block_left;
+    uint32_t bits;
+    int count;
+    bool ended;
+};
+
+struct frame_writer {
+    uint8_t *canvas;
+    uint8_t *history;
+    int canvas_width;
+    int left, top, width, height;
+    const Color *palette;
+    bool interlaced;
+
+    int x, row, pass;
+    size_t written;
+};
+
+static uint8_t read_u8(const struct gif_decoder *d, size_t pos);
+static uint16_t read_u16(const struct gif_decoder *d, size_t pos);
+static void skip_sub_blocks(const struct gif_decoder *d, size_t *pos);
+static void read_palette(const struct gif_decoder *d, size_t pos, int count,
+    Color *palette, int transparent);
+static void read_control(struct gif_decoder *d);
+static int read_code(struct bit_reader *r, int size);
+static void put_pixel(struct frame_writer *w, uint8_t index);
+static int read_frame(struct gif_decoder *d);
+static int draw_frame(struct gif_decoder *d);
+static int decode_image(struct gif_decoder *d, struct frame_writer *w);
+static void dispose_frame(struct gif_decoder *d);
+static size_t stream_slot(const struct gif_stream *s, size_t frame);
+static size_t stream_victim(const struct gif_stream *s, size_t keep);
+static int stream_decode(struct gif_stream *s, size_t frame, size_t slot);
+
+int gif_decoder_open(struct gif_decoder *d, const uint8_t *data, size_t size)
+{
+    memset(d, 0, sizeof(struct gif_decoder));
+
+    if (size < GIF_HEADER_SIZE || (memcmp(data, "GIF87a", 6) != 0 &&
+        memcmp(data, "GIF89a", 6) != 0))
+        return 1;
+
+    d->data = data;
+    d->size = size;
+    d->width = read_u16(d, 6);
+    d->height = read_u16(d, 8);
+    d->has_palette = data[10] & 0x80;
+    d->background_index = data[11];
+    d->start = GIF_HEADER_SIZE;
+    if (d->has_palette)
+        d->start += 3 * (2 << (data[10] & 7));
+
+    if (d->width == 0 || d->height == 0)
+        return 1;
+
+    /* count frames and collect delays without touching the pixels */
+    size_t capacity = 0;
+    size_t pos = d->start;
+    int delay = 0;
+    bool disposes = false;
+    bool restores = false;
+
+    for (;;) {
+        uint8_t block = read_u8(d, pos++);
+
+        if (block == 0x21) {
+            uint8_t label = read_u8(d, pos++);
+            if (label == 0xF9) {
+                uint8_t length = read_u8(d, pos++);
+                if (length != 4) {
+                    /* stb_image reads the next block right after it */
+                    pos += length;
+                    continue;
+                }
+
+                int dispose = (read_u8(d, pos) >> 2) & 7;
+                disposes |= dispose == 2 || dispose == 3;
+                restores |= dispose == 3;
+                /* frames without their own keep the last one */
+                delay = read_u16(d, pos + 1) * 10;
+                pos += 4;
+            }
+
+            skip_sub_blocks(d, &pos);
+        } else if (block == 0x2C) {
+            int left = read_u16(d, pos);
+            int top = read_u16(d, pos + 2);
+            uint8_t flags = read_u8(d, pos + 8);
+
+            /* a frame stb_image refuses ends the animation before it */
+            if (left + read_u16(d, pos + 4) > d->width ||
+                top + read_u16(d, pos + 6) > d->height ||
+                (!(flags & 0x80) && !d->has_palette))
+                break;
+
+            pos += 9;
+            if (flags & 0x80)
+                pos += 3 * (2 << (flags & 7));
+            /* LZW minimum code size, the data starts with a clear or end code */
+            int min_size = read_u8(d, pos++);
+            if (min_size > 11)
+                break;
+
+            struct bit_reader r = { .decoder = d, .pos = pos };
+            int code = read_code(&r, min_size + 1);
+            int clear = 1 << min_size;
+            if (code >= 0 && code != clear && code != clear + 1)
+                break;
+
+            /* one cut short still counts, it is drawn as far as it goes */
+            skip_sub_blocks(d, &pos);
+
+            if (d->frame_count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                d->delays = realloc(d->delays, capacity * sizeof(int));
+            }
+            d->delays[d->frame_count++] = delay;
+        } else
+            break; /* trailer, or garbage after the last frame */
+    }
+
+    if (d->frame_count == 0) {
+        gif_decoder_close(d);
+        return 1;
+    }
+
+    size_t pixels = (size_t) d->width * d->height;
+    d->canvas = malloc(pixels * 4);
+    d->history = malloc(pixels);
+    if (disposes)
+        d->background = malloc(pixels * 4);
+    if (restores) {
+        d->shown[0] = malloc(pixels * 4);
+        d->shown[1] = malloc(pixels * 4);
+    }
+
+    gif_decoder_rewind(d);
+    return 0;
+}
+
+int gif_decoder_next(struct gif_decoder *d, uint8_t *rgba)
+{
+    size_t pixels = (size_t) d->width * d->height;
+
+    if (d->frame == d->frame_count)
+        gif_decoder_rewind(d);
+
+    if (d->frame > 0)
+        dispose_frame(d);
+    if (d->background != NULL)
+        memcpy(d->background, d->canvas, pixels * 4);
+    memset(d->history, 0, pixels);
+
+    /* a broken frame still counts, it shows what it drew before it broke */
+    int result = read_frame(d);
+    if (d->shown[0] != NULL)
+        memcpy(d->shown[d->frame % 2], d->canvas, pixels * 4);
+
+    d->frame++;
+    if (rgba != NULL)
+        memcpy(rgba, d->canvas, pixels * 4);
+    return result;
+}
+
+/* back to how it was opened, the transparent index left its mark on the palette */
+void gif_decoder_rewind(struct gif_decoder *d)
+{
+    memset(d->canvas, 0, (size_t) d->width * d->height * 4);
+    memset(d->palette, 0, sizeof(d->palette));
+    memset(d->local, 0, sizeof(d->local));
+    if (d->has_palette)
+        read_palette(d, GIF_HEADER_SIZE, 2 << (d->data[10] & 7), d->palette, -1);
+
+    d->control = 0;
+    d->transparent = -1;
+    d->pos = d->start;
+    d->frame = 0;
+}
+
+void gif_decoder_close(struct gif_decoder *d)
+{
+    free(d->delays);
+    free(d->canvas);
+    free(d->history);
+    free(d->background);
+    free(d->shown[0]);
+    free(d->shown[1]);
+    d->delays = NULL;
+    d->canvas = NULL;
+    d->history = NULL;
+    d->background = NULL;
+    d->shown[0] = NULL;
+    d->shown[1] = NULL;
+}
+
+int gif_stream_open(struct gif_stream *s, const uint8_t *data, size_t size)
+{
+    if (gif_decoder_open(&s->decoder, data, size))
+        return 1;
+
+    for (int i = 0; i < GIF_STREAM_WINDOW; i++) {
+        s->ring[i] = malloc((size_t) s->decoder.width * s->decoder.height * 4);
+        s->ring_frame[i] = SIZE_MAX;
+        s->ring_used[i] = 0;
+    }
+
+    s->uses = 0;
+    s->shown = SIZE_MAX;
+    s->ahead = SIZE_MAX;
+    s->ahead_failed = false;
+    s->orphaned = false;
+    return 0;
+}
+
+struct gif_stream *gif_stream_new(const uint8_t *data, size_t size)
+{
+    struct gif_stream *s = malloc(sizeof(struct gif_stream));
+
+    if (gif_stream_open(s, data, size)) {
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+const uint8_t *gif_stream_frame(struct gif_stream *s, size_t frame)
+{
+    size_t slot = stream_slot(s, frame);
+
+    if (slot == GIF_STREAM_WINDOW) {
+        /* the decoder is not ours, show the last frame a while longer */
+        if (gif_stream_busy(s))
+            return NULL;
+
+        slot = stream_victim(s, SIZE_MAX);
+        /* broken data, show whatever is there */
+        s->ring_frame[slot] = stream_decode(s, frame, slot) ? SIZE_MAX : frame;
+    }
+
+    s->ring_used[slot] = ++s->uses;
+    s->shown = frame;
+    return s->ring[slot];
+}
+
+bool gif_stream_ahead_begin(struct gif_stream *s, size_t frame, size_t keep)
+{
+    if (gif_stream_busy(s) || stream_slot(s, frame) != GIF_STREAM_WINDOW)
+        return false;
+
+    /* going back past the first frame decodes all of them again */
+    if (frame < s->decoder.frame && frame != 0)
+        return false;
+
+    s->ahead = frame;
+    s->ahead_slot = stream_victim(s, keep);
+    s->ring_frame[s->ahead_slot] = SIZE_MAX;
+    return true;
+}
+
+void gif_stream_ahead_decode(struct gif_stream *s)
+{
+    s->ahead_failed = stream_decode(s, s->ahead, s->ahead_slot) != 0;
+}
+
+bool gif_stream_ahead_end(struct gif_stream *s)
+{
+    if (s->orphaned) {
+        gif_stream_close(s);
+        free(s);
+        return true;
+    }
+
+    if (!s->ahead_failed) {
+        s->ring_frame[s->ahead_slot] = s->ahead;
+        s->ring_used[s->ahead_slot] = ++s->uses;
+    }
+
+    s->ahead = SIZE_MAX;
+    return false;
+}
+
+bool gif_stream_busy(const struct gif_stream *s)
+{
+    return s->ahead != SIZE_MAX;
+}
+
+size_t gif_stream_size(const struct gif_stream *s)
+{
+    const struct gif_decoder *d = &s->decoder;
+    size_t pixels = (size_t) d->width * d->height;
+    size_t frames = GIF_STREAM_WINDOW + 1 + (d->background != NULL) +
+        2 * (d->shown[0] != NULL);
+
+    return pixels * 4 * frames + pixels + sizeof(struct gif_stream);
+}
+
+void gif_stream_close(struct gif_stream *s)
+{
+    for (int i = 0; i < GIF_STREAM_WINDOW; i++)
+        free(s->ring[i]);
+
+    gif_decoder_close(&s->decoder);
+}
+
+void gif_stream_release(struct gif_stream *s)
+{
+    if (gif_stream_busy(s)) {
+        /* still being decoded into, gif_stream_ahead_end frees it */
+        s->orphaned = true;
+        return;
+    }
+
+    gif_stream_close(s);
+    free(s);
+}
+
+static size_t stream_slot(const struct gif_stream *s, size_t frame)
+{
+    for (size_t i = 0; i < GIF_STREAM_WINDOW; i++) {
+        if (s->ring_frame[i] == frame)
+            return i;
+    }
+
+    return GIF_STREAM_WINDOW;
+}
+
+/* least recently used slot that holds neither the shown frame nor keep */
+static size_t stream_victim(const struct gif_stream *s, size_t keep)
+{
+    size_t victim = GIF_STREAM_WINDOW;
+
+    for (size_t i = 0; i < GIF_STREAM_WINDOW; i++) {
+        size_t frame = s->ring_frame[i];
+        if (frame != SIZE_MAX && (frame == s->shown || frame == keep))
+            continue;
+        if (victim == GIF_STREAM_WINDOW || s->ring_used[i] < s->ring_used[victim])
+            victim = i;
+    }
+
+    return victim;
+}
+
+/* frames only decode forward, the ones in between only touch the canvas */
+static int stream_decode(struct gif_stream *s, size_t frame, size_t slot)
+{
+    struct gif_decoder *d = &s->decoder;
+
+    if (frame < d->frame)
+        gif_decoder_rewind(d);
+
+    while (d->frame < frame) {
+        if (gif_decoder_next(d, NULL))
+            return 1;
+    }
+
+    return gif_decoder_next(d, s->ring[slot]);
+}
+
+/* stb_image reads zeros past the end, so does everything here */
+static uint8_t read_u8(const struct gif_decoder *d, size_t pos)
+{
+    return pos < d->size ? d->data[pos] : 0;
+}
+
+static uint16_t read_u16(const struct gif_decoder *d, size_t pos)
+{
+    return read_u8(d, pos) | read_u8(d, pos + 1) << 8;
+}
+
+/* the zero length block that ends them is also what the end reads as */
+static void skip_sub_blocks(const struct gif_decoder *d, size_t *pos)
+{
+    uint8_t length;
+    while ((length = read_u8(d, (*pos)++)) != 0)
+        *pos += length;
+}
+
+static void read_palette(const struct gif_decoder *d, size_t pos, int count,
+    Color *palette, int transparent)
+{
+    for (int i = 0; i < count; i++, pos += 3) {
+        palette[i] = (Color) { read_u8(d, pos), read_u8(d, pos + 1),
+            read_u8(d, pos + 2), i == transparent ? 0 : 0xFF };
+    }
+}
+
+/* graphic control extension, the transparent index is kept in the palette alpha */
+static void read_control(struct gif_decoder *d)
+{
+    d->control = read_u8(d, d->pos);
+    if (d->transparent >= 0)
+        d->palette[d->transparent].a = 0xFF;
+
+    d->transparent = -1;
+    if (d->control & 1) {
+        d->transparent = read_u8(d, d->pos + 3);
+        d->palette[d->transparent].a = 0;
+    }
+
+    d->pos += 4;
+}
+
+/* LZW codes are packed LSB first across length prefixed sub-blocks */
+static int read_code(struct bit_reader *r, int size)
+{
+    while (r->count < size) {
+        if (r->block_left == 0) {
+            r->block_left = read_u8(r->decoder, r->pos++);
+            if (r->block_left == 0) {
+                r->ended = true;
+                return -1;
+            }
+        }
+
+        r->bits |= (uint32_t) read_u8(r->decoder, r->pos++) << r->count;
+        r->count += 8;
+        r->block_left--;
+    }
+
+    int code = r->bits & ((1 << size) - 1);
+    r->bits >>= size;
+    r->count -= size;
+    return code;
+}
+
+static void put_pixel(struct frame_writer *w, uint8_t index)
+{
+    static const int starts[] = { 0, 4, 2, 1 };
+    static const int steps[] = { 8, 8, 4, 2 };
+
+    if (w->written >= (size_t) w->width * w->height)
+        return;
+
+    /* the frame is inside the canvas, draw_frame made sure */
+    size_t at = (size_t) (w->top + w->row) * w->canvas_width + w->left + w->x;
+    w->history[at] = 1;
+    if (w->palette[index].a > 128)
+        memcpy(w->canvas + at * 4, &w->palette[index], 4);
+
+    w->written++;
+    if (++w->x < w->width)
+        return;
+
+    w->x = 0;
+    if (!w->interlaced) {
+        w->row++;
+        return;
+    }
+
+    w->row += steps[w->pass];
+    while (w->row >= w->height && w->pass < 3) {
+        w->pass++;
+        w->row = starts[w->pass];
+    }
+}
+
+static int read_frame(struct gif_decoder *d)
+{
+    for (;;) {
+        uint8_t block = read_u8(d, d->pos++);
+
+        if (block == 0x21) {
+            uint8_t label = read_u8(d, d->pos++);
+            if (label == 0xF9) {
+                uint8_t length = read_u8(d, d->pos++);
+                if (length != 4) {
+                    d->pos += length;
+                    continue;
+                }
+
+                read_control(d);
+            }
+
+            skip_sub_blocks(d, &d->pos);
+        } else if (block == 0x2C)
+            return draw_frame(d);
+        else
+            return 1;
+    }
+}
+
+static int draw_frame(struct gif_decoder *d)
+{
+    size_t pixels = (size_t) d->width * d->height;
+    uint8_t flags = read_u8(d, d->pos + 8);
+    struct frame_writer w = {
+        .canvas = d->canvas,
+        .history = d->history,
+        .canvas_width = d->width,
+        .left = read_u16(d, d->pos),
+        .top = read_u16(d, d->pos + 2),
+        .width = read_u16(d, d->pos + 4),
+        .height = read_u16(d, d->pos + 6),
+        .palette = d->palette,
+        .interlaced = flags & 0x40,
+    };
+    d->pos += 9;
+
+    if (w.left + w.width > d->width || w.top + w.height > d->height)
+        return 1;
+
+    /* entries past the local palette are whatever the last one left */
+    if (flags & 0x80) {
+        int count = 2 << (flags & 7);
+        read_palette(d, d->pos, count, d->local, d->transparent);
+        w.palette = d->local;
+        d->pos += 3 * count;
+    } else if (!d->has_palette)
+        return 1;
+
+    if (decode_image(d, &w))
+        return 1;
+
+    /*
+     * The first frame leaves the background colour wherever it did not draw.
+     * stb_image keeps its palette as BGRA and copies that entry as is, so
+     * red and blue come out swapped.
+     */
+    if (d->frame == 0 && d->background_index > 0) {
+        Color *background = &d->palette[d->background_index];
+        uint8_t pixel[4] = { background->b, background->g, background->r, 0xFF };
+
+        for (size_t i = 0; i < pixels; i++) {
+            if (!d->history[i]) {
+                background->a = 0xFF;
+                memcpy(d->canvas + i * 4, pixel, 4);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* codes stb_image refuses fail the frame, it keeps what was drawn so far */
+static int decode_image(struct gif_decoder *d, struct frame_writer *w)
+{
+    int min_size = read_u8(d, d->pos++);
+    if (min_size > 11)
+        return 1;
+
+    struct bit_reader r = { .decoder = d, .pos = d->pos };
+    int clear = 1 << min_size;
+    int end = clear + 1;
+    int size = min_size + 1;
+    int avail = clear + 2;
+    int old = -1;
+    bool cleared = false;
+
+    for (int i = 0; i < clear; i++) {
+        d->suffix[i] = i;
+        d->first[i] = i;
+    }
+
+    for (;;) {
+        int code = read_code(&r, size);
+        if (code < 0)
+            break;
+
+        if (code == clear) {
+            size = min_size + 1;
+            avail = clear + 2;
+            old = -1;
+            cleared = true;
+            continue;
+        }
+
+        if (code == end) {
+            /* whatever is left of the image data */
+            r.pos += r.block_left;
+            skip_sub_blocks(d, &r.pos);
+            break;
+        }
+
+        /* the data has to start with a clear code */
+        if (code > avail || !cleared)
+            return 1;
+
+        if (old >= 0) {
+            if (avail < GIF_MAX_CODES) {
+                d->prefix[avail] = old;
+                d->first[avail] = d->first[old];
+                d->suffix[avail] = code == avail ? d->first[old] : d->first[code];
+            }
+
+            if (++avail > GIF_CODE_LIMIT)
+                return 1;
+        } else if (code == avail)
+            return 1;
+
+        int sp = 0;
+        for (int c = code; ; c = d->prefix[c]) {
+            if (c < clear) {
+                d->stack[sp++] = c;
+                break;
+            }
+            d->stack[sp++] = d->suffix[c];
+        }
+
+        while (sp > 0)
+            put_pixel(w, d->stack[--sp]);
+
+        if ((avail & ((1 << size) - 1)) == 0 && avail < GIF_MAX_CODES)
+            size++;
+
+        old = code;
+    }
+
+    d->pos = r.pos;
+    return 0;
+}
+
+/* undoes the last frame wherever it drew, stb_image style */
+static void dispose_frame(struct gif_decoder *d)
+{
+    int dispose = (d->control >> 2) & 7;
+    const uint8_t *restore = NULL;
+
+    /* two frames back only exists from the third frame on */
+    if (dispose == 3 && d->frame >= 2)
+        restore = d->shown[d->frame % 2];
+    else if (dispose == 2 || dispose == 3)
+        restore = d->background;
+
+    if (restore == NULL)
+        return;
+
+    size_t pixels = (size_t) d->width * d->height;
+    for (size_t i = 0; i < pixels; i++) {
+        if (d->history[i])
+            memcpy(d->canvas + i * 4, restore + i * 4, 4);
+    }
+}
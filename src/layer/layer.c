@@ -1,16 +1,28 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "unuv.h"
+#include <console.h>
 #include <layer/layer.h>
 #include <core/mask.h>
+#include <work/work.h>
+#include <work/scheduler.h>
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
-static enum un_action update_animation(un_timer *timer);
+/* decoded frames bigger than this are not kept in memory, they stream from the GIF */
+#define FRAMES_BUDGET (256ULL * 1024 * 1024)
+/* frames bigger than this stay in memory, the current one is uploaded as it comes up */
+#define GPU_FRAMES_BUDGET (64ULL * 1024 * 1024)
+/* GIFs without a delay are shown at 10 fps, same as browsers do */
+#define DEFAULT_FRAME_DELAY 100
+
+static double frame_delay(struct animated_layer *layer, size_t frame);
 static enum un_action after_timeout(un_timer *timer);
 static enum un_action after_toggle(un_timer *timer);
+static void decode_ahead(struct work *work);
+static void after_decode_ahead(struct work *work);
 
 void layer_override_name(struct layer *layer, char *name)
 {
@@ -19,18 +31,229 @@ void layer_override_name(struct layer *layer, char *name)
     layer->properties.name.buffer = name;
 }
 
+void layer_set_encoded(struct layer *layer, uint8_t *buffer, uint64_t size)
+{
+    if (layer->properties.png_file_content != buffer)
+        free(layer->properties.png_file_content);
+
+    layer->properties.png_file_content = buffer;
+    layer->properties.png_file_size = size;
+    layer->properties.is_dirty = buffer == NULL;
+}
+
 struct animated_layer *layer_get_animated(struct layer *layer)
 {
     assert(layer->properties.is_animated == true && "layer is not animated");
     return (void*) layer;
 }
 
-void layer_animated_start(struct animated_layer *layer, un_loop *loop)
+void layer_animated_start(struct animated_layer *layer)
 {
-    un_timer *timer = un_timer_new(loop);
-    un_timer_set_data(timer, layer);
-    uint32_t delay = layer->properties.frame_delays[0];
-    un_timer_start(timer, delay, delay, update_animation);
+    layer->properties.current_frame_index = 0;
+    layer->properties.frame_started = -1;
+    layer->properties.is_playing = true;
+}
+
+void layer_animated_tick(struct animated_layer *layer, double now,
+    struct work_scheduler *sched)
+{
+    struct animated_layer_properties *props = &layer->properties;
+    if (!props->is_playing || props->number_of_frames < 2)
+        return;
+
+    /* first frame since the start, or since the layer was hidden */
+    if (props->frame_started < 0) {
+        props->frame_started = now;
+        return;
+    }
+
+    size_t frame = props->current_frame_index;
+    double start = props->frame_started;
+
+    /* at most one loop worth of frames, anything older was missed anyway */
+    for (size_t i = 0; i < props->number_of_frames; i++) {
+        double delay = frame_delay(layer, frame);
+        if (now - start < delay)
+            break;
+
+        start += delay;
+        frame = (frame + 1) % props->number_of_frames;
+    }
+
+    /* stalled for more than a whole loop, pick up from here */
+    if (now - start >= frame_delay(layer, frame))
+        start = now;
+
+    props->frame_started = start;
+    if (frame == props->current_frame_index)
+        return;
+
+    props->current_frame_index = frame;
+
+    /* decode ahead on the threadpool so the draw only has to upload */
+    struct gif_stream *stream = props->stream;
+    if (stream != NULL && gif_stream_ahead_begin(stream,
+        (frame + 1) % props->number_of_frames, frame)) {
+        struct work *work = work_new(decode_ahead, after_decode_ahead, true);
+        work_set_context(work, stream);
+        work_scheduler_add_work(sched, work);
+    }
+}
+
+void layer_animated_upload(struct animated_layer *layer)
+{
+    Image *img = &layer->layer.properties.image;
+    size_t frames = layer->properties.number_of_frames;
+    size_t frame_size = (size_t) img->width * img->height * 4;
+    double mib = (double) (frame_size * frames) / (1024 * 1024);
+
+    if (layer_animated_streams(img->width, img->height, frames)) {
+        struct gif_stream *stream = gif_stream_new(layer->properties.gif_file_content,
+            layer->properties.gif_file_size);
+        if (stream == NULL) {
+            LOG_E("Unable to stream the animation, showing the first frame only", 0);
+            layer->properties.number_of_frames = 1;
+            return;
+        }
+
+        layer->properties.stream = stream;
+        LOG_I("Streaming %zu frames (%.1f MiB decoded) with %.1f MiB resident",
+            frames, mib, (double) gif_stream_size(stream) / (1024 * 1024));
+        return;
+    }
+
+    if (frame_size * frames > GPU_FRAMES_BUDGET) {
+        LOG_W("Animation of %zu frames needs %.1f MiB, uploading per frame instead",
+            frames, mib);
+        return;
+    }
+
+    double start = GetTime();
+    layer->properties.frame_textures = calloc(frames, sizeof(Texture2D));
+    /* the first frame was uploaded with the layer */
+    layer->properties.frame_textures[0] = layer->layer.properties.texture;
+
+    for (size_t i = 1; i < frames; i++) {
+        Image frame = *img;
+        frame.data = (void*) layer_animated_frame(layer, i);
+
+        Texture2D *texture = &layer->properties.frame_textures[i];
+        *texture = LoadTextureFromImage(frame);
+        SetTextureFilter(*texture, TEXTURE_FILTER_BILINEAR);
+        GenTextureMipmaps(texture);
+        SetTextureWrap(*texture, TEXTURE_WRAP_CLAMP);
+    }
+
+    LOG_I("Uploaded %zu frames, %.1f MiB of VRAM in %.2f ms", frames, mib,
+        (GetTime() - start) * 1000);
+}
+
+void layer_animated_compact(struct animated_layer *layer)
+{
+    Image *img = &layer->layer.properties.image;
+    size_t frames = layer->properties.number_of_frames;
+    if (layer->properties.stream != NULL || frames == 1)
+        return;
+
+    double rgba_mib = (double) img->width * img->height * 4 * frames / (1024 * 1024);
+
+    struct indexed_frames *indexed = malloc(sizeof(struct indexed_frames));
+    if (!indexed_frames_from_rgba(indexed, img->data, img->width, img->height,
+        frames)) {
+        LOG_I("Animation has more than %d colors in a frame, keeping %.1f MiB of RGBA",
+            INDEXED_PALETTE_SIZE, rgba_mib);
+        free(indexed);
+        return;
+    }
+
+    LOG_I("Animation frames indexed, %.1f MiB instead of %.1f MiB",
+        (double) indexed_frames_size(indexed) / (1024 * 1024), rgba_mib);
+
+    layer->properties.indexed = indexed;
+    UnloadImage(*img);
+    img->data = NULL;
+}
+
+const uint8_t *layer_animated_frame(struct animated_layer *layer, size_t frame)
+{
+    Image *img = &layer->layer.properties.image;
+
+    if (layer->properties.stream != NULL)
+        return gif_stream_frame(layer->properties.stream, frame);
+
+    if (layer->properties.indexed != NULL)
+        return indexed_frames_expand(layer->properties.indexed, frame);
+
+    return (uint8_t*) img->data + (size_t) img->width * img->height * 4 * frame;
+}
+
+bool layer_animated_update_frame(struct animated_layer *layer)
+{
+    const uint8_t *pixels = layer_animated_frame(layer,
+        layer->properties.current_frame_index);
+    if (pixels == NULL)
+        return false;
+
+    UpdateTexture(layer->layer.properties.texture, pixels);
+    return true;
+}
+
+void layer_animated_unload(struct animated_layer *layer)
+{
+    if (layer->properties.stream != NULL) {
+        gif_stream_release(layer->properties.stream);
+        layer->properties.stream = NULL;
+    }
+
+    if (layer->properties.indexed != NULL) {
+        indexed_frames_free(layer->properties.indexed);
+        free(layer->properties.indexed);
+        layer->properties.indexed = NULL;
+    }
+
+    if (layer->properties.frame_textures == NULL)
+        return;
+
+    for (uint64_t i = 1; i < layer->properties.number_of_frames; i++)
+        UnloadTexture(layer->properties.frame_textures[i]);
+
+    layer->layer.properties.texture = layer->properties.frame_textures[0];
+    free(layer->properties.frame_textures);
+    layer->properties.frame_textures = NULL;
+}
+
+bool layer_animated_streams(int width, int height, size_t frames)
+{
+    return (uint64_t) width * height * 4 * frames > FRAMES_BUDGET;
+}
+
+Image layer_load_gif(const uint8_t *data, size_t size, int *frames, int **delays)
+{
+    struct gif_decoder *d = malloc(sizeof(struct gif_decoder));
+
+    if (gif_decoder_open(d, data, size) == 0 &&
+        layer_animated_streams(d->width, d->height, d->frame_count)) {
+        Image img = {
+            .data = malloc((size_t) d->width * d->height * 4),
+            .width = d->width,
+            .height = d->height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        };
+
+        gif_decoder_next(d, img.data);
+        *frames = d->frame_count;
+        *delays = d->delays;
+        d->delays = NULL;
+
+        gif_decoder_close(d);
+        free(d);
+        return img;
+    }
+
+    gif_decoder_close(d);
+    free(d);
+    return LoadImageAnimFromMemory(".gif", data, size, frames, delays);
 }
 
 void layer_start_timeout(struct layer *layer, un_loop *loop)
@@ -54,23 +277,10 @@ void layer_cleanup(struct layer *layer)
 {
 }
 
-static enum un_action update_animation(un_timer *timer)
+static double frame_delay(struct animated_layer *layer, size_t frame)
 {
-    struct animated_layer *layer = un_timer_get_data(timer);
-
-    layer->properties.previous_frame_index = layer->properties.current_frame_index;
-    un_timer_set_repeat(timer, layer->properties.frame_delays[layer->properties.current_frame_index]);
-    layer->properties.current_frame_index = (layer->properties.current_frame_index + 1) %
-        layer->properties.number_of_frames;
-
-    if (layer->layer.state.prepare_for_deletion) {
-        if (!layer->layer.state.active) {
-            layer_cleanup(&layer->layer);
-            return DISARM;
-        }
-    }
-
-    return REARM;
+    uint32_t delay = layer->properties.frame_delays[frame];
+    return (delay == 0 ? DEFAULT_FRAME_DELAY : delay) / 1000.0;
 }
 
 static enum un_action after_timeout(un_timer *timer)
@@ -93,3 +303,15 @@ static enum un_action after_toggle(un_timer *timer)
 
     return DISARM;
 }
+
+/* runs on the threadpool, owns the decoder until after_decode_ahead */
+static void decode_ahead(struct work *work)
+{
+    gif_stream_ahead_decode(work->ctx);
+}
+
+static void after_decode_ahead(struct work *work)
+{
+    /* frees the stream if the layer was unloaded meanwhile */
+    gif_stream_ahead_end(work->ctx);
+}
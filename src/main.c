@@ -51,6 +51,8 @@
 #endif
 #define DEFAULT_MULTIPLIER 2500
 #define DEFAULT_TIMER_TTL 2000
+#define DEFAULT_WORK_BUDGET_US 4000
+#define TARGET_FPS 60
 #define DEFAULT_MASK (QUIET | TALK | PAUSE)
 
 #define TOML_ERR_LEN UINT8_MAX
@@ -60,8 +62,10 @@ static char script_filter[] = "lua;";
 static char model_filter[] = "opng;";
 struct context ctx = {0};
 
-static enum un_action update(un_idle *task);
-static enum un_action draw(un_idle *task);
+static void update(uv_idle_t *task);
+static void draw(uv_idle_t *task);
+static bool frame_changed(void);
+static void after_frame_wait(uv_timer_t *timer);
 static void draw_menubar(bool *ui_focused);
 
 static void load_layer();
@@ -76,18 +80,6 @@ static void after_layer_loaded(uv_work_t *req, int status);
 static void load_script_file(uv_work_t *req);
 static void after_script_loaded(uv_work_t *req, int status);
 
-static void onAudioData(ma_device* device, void* output, const void* input, ma_uint32 frameCount) {
-    struct microphone_data* data = device->pUserData;
-    float* inputData = (float*)input;
-
-    float sum = 0.0f;
-    for (ma_uint32 i = 0; i < frameCount; i++) {
-        sum += inputData[i] * inputData[i];
-    }
-
-    atomic_store(&data->volume, sqrtf(sum / frameCount) * atomic_load(&data->multiplier));
-}
-
 static void draw_grid(int line_width, int spacing, Color color)
 {
     float width = GetScreenWidth();
@@ -140,11 +132,14 @@ int c_main()
     ctx.editor.mic = &ctx.mic;
     ctx.editor.microphone_trigger = 40;
     ctx.editor.timer_ttl = DEFAULT_TIMER_TTL;
+    talk_fsm_init(&ctx.editor.talk);
+    ctx.editor.render_skip = true;
     ctx.mask |= QUIET;
     ctx.welcome_win.show = true;
 
     /* scheduler */
     ctx.sched.loop = ctx.loop;
+    work_scheduler_set_budget(&ctx.sched, DEFAULT_WORK_BUDGET_US);
     ctx.model.scheduler = &ctx.sched;
     ctx.model.editor = &ctx.editor;
     ctx.model.mic = &ctx.mic;
@@ -181,24 +176,11 @@ int c_main()
     /* MINIAUDIO */
     ctx.mic.multiplier = DEFAULT_MULTIPLIER;
     atomic_store(&ctx.mic.multiplier, DEFAULT_MULTIPLIER);
-    ma_result result;
-    ma_device_config deviceConfig = ma_device_config_init(ma_device_type_capture);
-    deviceConfig.capture.format = ma_format_f32;
-    deviceConfig.capture.channels = 1; // Use 1 channel for microphone
-    deviceConfig.sampleRate = 44100;
-    deviceConfig.dataCallback = onAudioData;
-
-    result = ma_device_init(NULL, &deviceConfig, &ctx.mic.device);
-    if (result != MA_SUCCESS) {
-        LOG_E("Failed to initialize device.\n", 0);
-        return -1;
-    }
-
-    ctx.mic.device.pUserData = &ctx.mic;
+    ctx.mic.config.period_frames = CAPTURE_PERIOD_FRAMES;
+    ctx.mic.config.periods = CAPTURE_PERIODS;
 
-    result = ma_device_start(&ctx.mic.device);
-    if (result != MA_SUCCESS) {
-        LOG_E("Failed to start device.\n", 0);
+    if (capture_start(&ctx.mic)) {
+        LOG_E("Failed to start the microphone", 0);
         return -1;
     }
 
@@ -228,17 +210,29 @@ int c_main()
 #endif
     ctx.editor.background_color = (Color) { 0x18, 0x18, 0x18, 0xFF };
 
-    SetTargetFPS(60);
+    SetTargetFPS(TARGET_FPS);
 
-    /* event loop */
-    un_run_idle(ctx.loop, draw);
-    un_run_idle(ctx.loop, update);
+    /* event loop, draw and update stop while a skipped frame waits on the timer */
+    uv_loop_t *loop = (uv_loop_t*) ctx.loop;
+    uv_idle_init(loop, &ctx.draw_task);
+    uv_idle_init(loop, &ctx.update_task);
+    uv_timer_init(loop, &ctx.frame_timer);
+    uv_idle_start(&ctx.draw_task, draw);
+    uv_idle_start(&ctx.update_task, update);
 
     un_loop_run(ctx.loop);
+
+    uv_close((uv_handle_t*) &ctx.draw_task, NULL);
+    uv_close((uv_handle_t*) &ctx.update_task, NULL);
+    uv_close((uv_handle_t*) &ctx.frame_timer, NULL);
+    /* the handles are only closed once the loop goes around again */
+    uv_run(loop, UV_RUN_NOWAIT);
     un_loop_del(ctx.loop);
+    work_scheduler_cleanup(&ctx.sched);
 
+    redraw_free(&ctx.redraw);
     cleanup_icons();
-    ma_device_uninit(&ctx.mic.device);
+    capture_stop(&ctx.mic);
     filedialog_deinit(&ctx.dialog);
     console_deinit();
     UnloadNuklear(ctx.ctx);
@@ -247,11 +241,27 @@ int c_main()
     return 0;
 }
 
-static enum un_action draw(un_idle *task)
+static void draw(uv_idle_t *task)
 {
     if (WindowShouldClose())
         uv_stop((uv_loop_t*) ctx.loop);
 
+    layer_manager_tick(ctx.editor.layer_manager, &ctx.sched);
+
+    if (!frame_changed()) {
+        /*
+         * The last frame is still on screen. Rather than sleep in here, stop
+         * spinning and let the loop block until the next frame is due, work
+         * and timers finishing in the meantime still wake it up.
+         */
+        nk_clear(ctx.ctx);
+        ctx.frame_wait = true;
+        uv_idle_stop(&ctx.draw_task);
+        uv_timer_start(&ctx.frame_timer, after_frame_wait, 1000 / TARGET_FPS, 0);
+        return;
+    }
+
+    layer_manager_prepare(ctx.editor.layer_manager);
     BeginDrawing();
 
     Color inverted = {255, 255, 255, 255};
@@ -275,13 +285,35 @@ static enum un_action draw(un_idle *task)
 
     if (WindowShouldClose())
         uv_stop((uv_loop_t*) ctx.loop);
+}
 
-    return REARM;
+static bool frame_changed(void)
+{
+    struct layer_manager *mgr = ctx.editor.layer_manager;
+
+    if (!ctx.editor.render_skip || layer_manager_is_animating(mgr)) {
+        redraw_invalidate(&ctx.redraw);
+        return true;
+    }
+
+    struct redraw_state state;
+    memset(&state, 0, sizeof(struct redraw_state));
+    state.mask = get_current_mask();
+    state.camera = ctx.camera;
+    state.background = ctx.editor.background_color;
+    state.mode = ctx.mode;
+    state.width = GetScreenWidth();
+    state.height = GetScreenHeight();
+    state.focused = IsWindowFocused();
+    state.hide_ui = ctx.hide_ui;
+    state.layers = layer_manager_signature(mgr);
+
+    return redraw_needed(&ctx.redraw, &state, ctx.ctx);
 }
 
 void draw_props(struct layer_manager *mgr, struct nk_context *ctx, bool *ui_focused);
 
-static enum un_action update(un_idle *task)
+static void update(uv_idle_t *task)
 {
     mask_t mask = get_current_mask();
     handle_key_mask(&mask);
@@ -425,7 +457,19 @@ static enum un_action update(un_idle *task)
     if (WindowShouldClose())
         uv_stop((uv_loop_t*) ctx.loop);
 
-    return REARM;
+    /* handled what came in with the skipped frame, sleep along with draw */
+    if (ctx.frame_wait)
+        uv_idle_stop(&ctx.update_task);
+}
+
+/* input is only seen by polling, once per frame as before */
+static void after_frame_wait(uv_timer_t *timer)
+{
+    ctx.frame_wait = false;
+    PollInputEvents();
+
+    uv_idle_start(&ctx.draw_task, draw);
+    uv_idle_start(&ctx.update_task, update);
 }
 
 static void draw_menubar(bool *ui_focused)
@@ -466,6 +510,9 @@ static void draw_menubar(bool *ui_focused)
                 ctx.loading_state = WRITING_MODEL;
             }
 
+            nk_checkbox_label(nk_ctx, "Fast load cache", &ctx.save_pixel_cache);
+            nk_checkbox_label(nk_ctx, "Indexed format (v2)", &ctx.save_indexed);
+
             if (ctx.mode == EDIT_MODE) {
                 nk_layout_row_dynamic(nk_ctx, 2, 1);
                 nk_rule_horizontal(nk_ctx, nk_ctx->style.window.border_color,
@@ -571,7 +618,13 @@ static void write_model()
 #ifdef _WIN32
         *tmpbuf = ctx.dialog.current_drive_letter;
 #endif
-        model_write(&ctx.model, tmpbuf);
+        int flags = 0;
+        if (ctx.save_pixel_cache)
+            flags |= MODEL_WRITE_PIXEL_CACHE;
+        if (ctx.save_indexed)
+            flags |= MODEL_WRITE_INDEXED;
+
+        model_write(&ctx.model, tmpbuf, flags);
         filedialog_up(&ctx.dialog);
         ctx.dialog.file_out_name.cleanup = true;
     } else {
@@ -605,12 +658,15 @@ static void load_layer_file(uv_work_t *req)
 {
     struct image_load_req *work = req->data;
     if (strcmp(work->ext, ".gif") == 0) {
-        work->img = LoadImageAnimFromMemory(work->ext, work->buffer,
-            work->size, &work->frames_count, &work->delays);
+        work->img = layer_load_gif(work->buffer, work->size,
+            &work->frames_count, &work->delays);
         memcpy(work->gif_buffer, work->buffer, work->size);
     }
-    else
+    else {
         work->img = LoadImageFromMemory(work->ext, work->buffer, work->size);
+        if (work->png_buffer != NULL)
+            memcpy(work->png_buffer, work->buffer, work->size);
+    }
 }
 
 static void after_layer_loaded(uv_work_t *req, int status)
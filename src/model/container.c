@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <model/container.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int entry_compare(const void *a, const void *b);
+static bool record_plausible(struct container *c, const struct container_record *record);
+static void writer_flush(struct container_writer *w, ZSTD_inBuffer *in,
+    ZSTD_EndDirective mode);
+static void writer_output(struct container_writer *w, const void *data, size_t size);
+
+bool container_detect(const void *data, size_t size)
+{
+    return size >= sizeof(struct container_header) &&
+        memcmp(data, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) == 0;
+}
+
+int container_open(struct container *c, const void *data, size_t size)
+{
+    struct container_header header;
+
+    memset(c, 0, sizeof(struct container));
+    if (!container_detect(data, size))
+        return 1;
+
+    memcpy(&header, data, sizeof(header));
+    if (header.version != CONTAINER_VERSION || header.toc_offset > size ||
+        header.toc_size > size - header.toc_offset ||
+        header.entry_count > header.toc_size / sizeof(struct container_record))
+        return 1;
+
+    c->base = data;
+    c->size = size;
+    c->entries = calloc(header.entry_count, sizeof(struct container_entry));
+    if (c->entries == NULL)
+        return 1;
+
+    const uint8_t *toc = c->base + header.toc_offset;
+    const uint8_t *end = toc + header.toc_size;
+
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        struct container_record record;
+        if ((size_t) (end - toc) < sizeof(record))
+            goto fail;
+
+        memcpy(&record, toc, sizeof(record));
+        toc += sizeof(record);
+
+        if ((size_t) (end - toc) < record.pathname_length ||
+            record.offset > header.toc_offset ||
+            record.compressed_size > header.toc_offset - record.offset ||
+            !record_plausible(c, &record))
+            goto fail;
+
+        struct container_entry *entry = &c->entries[c->entry_count++];
+        entry->pathname = strndup((const char*) toc, record.pathname_length);
+        entry->offset = record.offset;
+        entry->compressed_size = record.compressed_size;
+        entry->size = record.size;
+        toc += record.pathname_length;
+    }
+
+    qsort(c->entries, c->entry_count, sizeof(struct container_entry),
+        entry_compare);
+    return 0;
+
+fail:
+    container_close(c);
+    return 1;
+}
+
+const struct container_entry *container_find(struct container *c, const char *pathname)
+{
+    struct container_entry key = { .pathname = (char*) pathname };
+    return bsearch(&key, c->entries, c->entry_count,
+        sizeof(struct container_entry), entry_compare);
+}
+
+uint8_t *container_read(struct container *c, const struct container_entry *entry,
+    bool terminate)
+{
+    uint8_t *buffer = malloc(entry->size + terminate);
+    if (buffer == NULL)
+        return NULL;
+
+    size_t res = ZSTD_decompress(buffer, entry->size, c->base + entry->offset,
+        entry->compressed_size);
+    if (ZSTD_isError(res) || res != entry->size) {
+        free(buffer);
+        return NULL;
+    }
+
+    if (terminate)
+        buffer[entry->size] = 0;
+
+    return buffer;
+}
+
+void container_close(struct container *c)
+{
+    for (size_t i = 0; i < c->entry_count; i++)
+        free(c->entries[i].pathname);
+
+    free(c->entries);
+    memset(c, 0, sizeof(struct container));
+}
+
+int container_writer_open(struct container_writer *w, const char *path)
+{
+    memset(w, 0, sizeof(struct container_writer));
+
+    w->file = fopen(path, "wb");
+    if (w->file == NULL)
+        return 1;
+
+    w->cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(w->cctx, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+    w->out_size = ZSTD_CStreamOutSize();
+    w->out = malloc(w->out_size);
+
+    /* patched with the real header once the table of contents is known */
+    struct container_header header = {0};
+    writer_output(w, &header, sizeof(header));
+    return 0;
+}
+
+void container_writer_begin(struct container_writer *w, const char *pathname,
+    uint64_t size)
+{
+    if (w->entry_count == w->entry_capacity) {
+        w->entry_capacity = w->entry_capacity ? w->entry_capacity * 2 : 16;
+        w->entries = realloc(w->entries,
+            w->entry_capacity * sizeof(struct container_entry));
+    }
+
+    w->current = &w->entries[w->entry_count++];
+    w->current->pathname = strdup(pathname);
+    w->current->offset = w->offset;
+    w->current->compressed_size = 0;
+    w->current->size = size;
+
+    /* written into the frame header, the reader checks size against it */
+    ZSTD_CCtx_setPledgedSrcSize(w->cctx, size);
+}
+
+void container_writer_data(struct container_writer *w, const void *data, size_t size)
+{
+    ZSTD_inBuffer in = { data, size, 0 };
+    writer_flush(w, &in, ZSTD_e_continue);
+}
+
+void container_writer_end(struct container_writer *w)
+{
+    ZSTD_inBuffer in = { NULL, 0, 0 };
+    writer_flush(w, &in, ZSTD_e_end);
+
+    w->current->compressed_size = w->offset - w->current->offset;
+    w->current = NULL;
+}
+
+int container_writer_close(struct container_writer *w)
+{
+    struct container_header header = {
+        .magic = CONTAINER_MAGIC,
+        .version = CONTAINER_VERSION,
+        .entry_count = w->entry_count,
+        .toc_offset = w->offset,
+    };
+
+    for (size_t i = 0; i < w->entry_count; i++) {
+        struct container_entry *entry = &w->entries[i];
+        struct container_record record = {
+            .offset = entry->offset,
+            .compressed_size = entry->compressed_size,
+            .size = entry->size,
+            .pathname_length = strlen(entry->pathname),
+        };
+
+        writer_output(w, &record, sizeof(record));
+        writer_output(w, entry->pathname, record.pathname_length);
+        free(entry->pathname);
+    }
+
+    header.toc_size = w->offset - header.toc_offset;
+    if (fseek(w->file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, w->file) != 1)
+        w->failed = true;
+
+    if (fclose(w->file) != 0)
+        w->failed = true;
+
+    ZSTD_freeCCtx(w->cctx);
+    free(w->out);
+    free(w->entries);
+
+    return w->failed;
+}
+
+static int entry_compare(const void *a, const void *b)
+{
+    const struct container_entry *x = a, *y = b;
+    return strcmp(x->pathname, y->pathname);
+}
+
+/*
+ * size comes from the file and is allocated as is by container_read. The
+ * frame has to say the same, and a zstd block of at most 128 KiB takes
+ * at least 4 bytes, so no frame grows more than that.
+ */
+static bool record_plausible(struct container *c, const struct container_record *record)
+{
+    unsigned long long content = ZSTD_getFrameContentSize(c->base + record->offset,
+        record->compressed_size);
+    if (content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR ||
+        content != record->size)
+        return false;
+
+    return record->size / CONTAINER_MAX_BLOCK <= record->compressed_size / 4;
+}
+
+/* every entry ends its own frame, nothing is shared between them */
+static void writer_flush(struct container_writer *w, ZSTD_inBuffer *in,
+    ZSTD_EndDirective mode)
+{
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer out = { w->out, w->out_size, 0 };
+        remaining = ZSTD_compressStream2(w->cctx, &out, in, mode);
+        if (ZSTD_isError(remaining)) {
+            w->failed = true;
+            return;
+        }
+
+        writer_output(w, w->out, out.pos);
+    } while (mode == ZSTD_e_end ? remaining != 0 : in->pos != in->size);
+}
+
+static void writer_output(struct container_writer *w, const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, size, 1, w->file) != 1)
+        w->failed = true;
+
+    w->offset += size;
+}
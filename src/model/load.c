@@ -5,21 +5,31 @@
 #include <archive_entry.h>
 #include <console.h>
 #include <model/model.h>
+#include <model/pixel_cache.h>
+#include <model/container.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
 #define TOML_ERR_LEN 255
 
-enum read_state {
-    READER_READ_MANIFEST,
-    READER_LAYER_PREPARE,
-    READER_READ_LAYER_INFO,
-    READER_READ_LAYER_IMG,
-    READER_READ_DONE,
-    READER_SETUP_TIMERS,
-    READER_READ_FAIL,
+struct model_reader;
+
+/*
+ * an archive entry, read off the main thread. Entries of uncompressed
+ * archives are borrowed straight from the mapping instead of copied.
+ * The app writes zstd tars and containers, only outside tars borrow.
+ */
+struct archive_blob {
+    char *pathname;
+    uint8_t *data;
+    size_t size;
+    mode_t type;
+    bool borrowed;
+    struct archive_blob *next;
 };
 
 struct layer_info {
@@ -31,9 +41,22 @@ struct layer_info {
 
     uint8_t *image_buffer;
     size_t image_size;
+    /* optional pre-decoded pixels, see pixel_cache.h */
+    uint8_t *pixel_buffer;
+    size_t pixel_size;
+    /* pointing into the mapping, must not be freed */
+    bool image_borrowed;
+    bool pixel_borrowed;
+    /* indexed models, read on the decode thread */
+    const struct container_entry *toml_entry;
+    const struct container_entry *image_entry;
+    const struct container_entry *pixel_entry;
     Image img;
     int frame_count;
 
+    /* position in the layer stack, in manifest order */
+    size_t slot;
+    struct model_reader *reader;
     struct layer_info *next;
 };
 
@@ -45,33 +68,66 @@ struct model_manifest {
     struct layer_info *layers;
 };
 
+/*
+ * read -> prepare -> decode (per layer) -> create (per layer) -> finish
+ * finish is the only node that frees the reader, cancelled or not.
+ * Indexed models skip read, every decode reads its own entries.
+ */
 struct model_reader {
     un_loop *loop;
     struct model *model;
     struct model_manifest manifest;
     struct archive *archive;
-    struct archive_entry *entry;
-    enum read_state state;
+    struct archive_blob *blobs;
+    struct container container;
+    bool indexed;
+    bool failed;
 
     struct layer **layers;
-    int current_layer;
-    struct layer_info *current;
+    struct work *finish;
+    struct work_token token;
+    /* bytes handed out as views into the mapping */
+    size_t borrowed;
 
     int fd;
     void *mmaped;
     size_t mmaped_size;
 };
 
-static void read_archive(struct work *work);
-static void after_read(struct work *work);
-
-static int parse_manifest(struct model_reader *rd);
-static int parse_layer_info(struct model_reader *rd);
+static struct work *reader_work(struct model_reader *rd, work_fn perform,
+    work_done finished, bool run_on_thread, void *ctx);
+static void read_entries(struct work *work);
+static void read_blob_data(struct model_reader *rd, struct archive_blob *blob);
+static char *blob_string(struct archive_blob *blob);
+static void blob_free(struct archive_blob *blob);
+static void prepare_layers(struct work *work);
+static void decode_layer(struct work *work);
+static void read_layer_entries(struct layer_info *info);
+static bool decode_pixel_cache(struct layer_info *info);
+static void create_layer(struct work *work);
+static void after_create(struct work *work);
+static void finish_load(struct work *work);
+static void after_load(struct work *work);
+static void reader_free(struct model_reader *rd);
+static void layer_info_free(struct layer_info *info);
+
+static int route_blobs(struct model_reader *rd);
+static int route_entries(struct model_reader *rd);
+static const struct container_entry *find_layer_entry(struct model_reader *rd,
+    const char *format, struct layer_info *info, const char *ext);
+static int parse_manifest(struct model_reader *rd, char *config_str);
+static int parse_layer_info(struct model_reader *rd, struct layer_info *info);
 static int manifest_load_layers(struct model_manifest *manifest, toml_table_t *conf);
 static struct layer_info *manifest_find_layer(struct model_manifest *manifest, const char *pathname);
 
 void model_load(un_loop *loop, struct model *model, const char *path)
 {
+    /* the save still reads the layers the load would replace */
+    if (layer_manager_is_pinned(model->editor->layer_manager)) {
+        LOG_E("Wait for the model to finish saving before loading %s", path);
+        return;
+    }
+
     struct stat s;
     stat(path, &s);
 
@@ -84,185 +140,544 @@ void model_load(un_loop *loop, struct model *model, const char *path)
 
     LOG_I("Preparing to load %s", path);
 
+    /* whatever is still loading is stale now */
+    if (model->load_token != NULL) {
+        LOG_W("Cancelling the previous model load", 0);
+        work_scheduler_cancel(model->scheduler, model->load_token);
+    }
+
     struct model_reader *rd = calloc(1, sizeof(struct model_reader));
     rd->loop = loop;
     rd->model = model;
-    rd->archive = archive_read_new();
     rd->fd = fd;
     rd->mmaped = mmaped;
     rd->mmaped_size = s.st_size;
     rd->layers = NULL;
-    rd->current_layer = 0;
-    rd->current = NULL;
+    rd->indexed = container_detect(mmaped, s.st_size);
+
+    struct work *prepare = reader_work(rd, prepare_layers, NULL, false, rd);
+    rd->finish = reader_work(rd, finish_load, after_load, false, rd);
+    work_depends_on(rd->finish, prepare);
+    model->load_token = &rd->token;
+
+    work_scheduler_add_work(model->scheduler, rd->finish);
+
+    /* the index is read in place, only tars have to be walked first */
+    if (!rd->indexed) {
+        rd->archive = archive_read_new();
+        archive_read_support_filter_zstd(rd->archive);
+        archive_read_support_format_tar(rd->archive);
+        archive_read_open_memory(rd->archive, mmaped, s.st_size);
+
+        struct work *read = reader_work(rd, read_entries, NULL, true, rd);
+        work_depends_on(prepare, read);
+        work_scheduler_add_work(model->scheduler, prepare);
+        work_scheduler_add_work(model->scheduler, read);
+    } else
+        work_scheduler_add_work(model->scheduler, prepare);
+}
+
+static struct work *reader_work(struct model_reader *rd, work_fn perform,
+    work_done finished, bool run_on_thread, void *ctx)
+{
+    struct work *work = work_new(perform, finished, run_on_thread);
+    work_set_context(work, ctx);
+    work_set_priority(work, WORK_PRIORITY_LOAD);
+    work_set_token(work, &rd->token);
+    return work;
+}
+
+/* runs on the threadpool, slurps the whole archive */
+static void read_entries(struct work *work)
+{
+    struct model_reader *rd = work->ctx;
+    struct archive_entry *entry;
+    struct archive_blob **tail = &rd->blobs;
+
+    while (archive_read_next_header(rd->archive, &entry) == ARCHIVE_OK) {
+        struct archive_blob *blob = calloc(1, sizeof(struct archive_blob));
+        blob->pathname = strdup(archive_entry_pathname(entry));
+        blob->type = archive_entry_filetype(entry);
+
+        if (blob->type == AE_IFREG) {
+            blob->size = archive_entry_size(entry);
+            read_blob_data(rd, blob);
+        } else
+            archive_read_data_skip(rd->archive);
 
-    archive_read_support_filter_zstd(rd->archive);
-    archive_read_support_format_tar(rd->archive);
-    archive_read_open_memory(rd->archive, mmaped, s.st_size);
-    rd->state = READER_READ_MANIFEST;
+        *tail = blob;
+        tail = &blob->next;
+    }
+
+    /* the mapping stays until the reader is freed, blobs may point into it */
+    archive_read_close(rd->archive);
+    archive_read_free(rd->archive);
+    rd->archive = NULL;
+}
+
+static void read_blob_data(struct model_reader *rd, struct archive_blob *blob)
+{
+    const uint8_t *base = rd->mmaped;
+    const void *block;
+    size_t length;
+    int64_t offset;
+
+    int res = archive_read_data_block(rd->archive, &block, &length, &offset);
+
+    /* without a filter libarchive hands out pointers into our memory */
+    if (res == ARCHIVE_OK && offset == 0 && length == blob->size &&
+        (const uint8_t*) block >= base &&
+        (const uint8_t*) block + length <= base + rd->mmaped_size) {
+        blob->data = (uint8_t*) block;
+        blob->borrowed = true;
+        rd->borrowed += length;
+        return;
+    }
+
+    /* toml wants a terminated string */
+    blob->data = calloc(blob->size + 1, sizeof(uint8_t));
+    while (res == ARCHIVE_OK) {
+        if (offset >= 0 && (size_t) offset < blob->size) {
+            size_t left = blob->size - offset;
+            memcpy(blob->data + offset, block, length < left ? length : left);
+        }
+        res = archive_read_data_block(rd->archive, &block, &length, &offset);
+    }
+}
 
-    struct work *work = work_new(read_archive, after_read, false);
-    work_set_context(work, rd);
+/* terminated copy for borrowed entries, takes the buffer otherwise */
+static char *blob_string(struct archive_blob *blob)
+{
+    char *str = (char*) blob->data;
+
+    if (blob->borrowed) {
+        str = calloc(blob->size + 1, sizeof(char));
+        memcpy(str, blob->data, blob->size);
+    }
 
-    work_scheduler_add_work(model->scheduler, work);
+    blob->data = NULL;
+    blob->borrowed = false;
+    return str;
 }
 
-static void read_archive(struct work *work)
+static void blob_free(struct archive_blob *blob)
+{
+    free(blob->pathname);
+    if (!blob->borrowed)
+        free(blob->data);
+    free(blob);
+}
+
+static void prepare_layers(struct work *work)
 {
     struct model_reader *rd = work->ctx;
-    switch (rd->state) {
-    case READER_READ_MANIFEST: {
-        if ((archive_read_next_header(rd->archive, &rd->entry)) != ARCHIVE_OK) {
-            archive_read_close(rd->archive);
-            archive_read_free(rd->archive);
-            munmap(rd->mmaped, rd->mmaped_size);
-            close(rd->fd);
-            rd->state = READER_LAYER_PREPARE;
-            return;
+
+    if (rd->indexed ? route_entries(rd) : route_blobs(rd)) {
+        rd->failed = true;
+        return;
+    }
+
+    if (rd->borrowed > 0)
+        LOG_I("Read %zu bytes in place", rd->borrowed);
+
+    LOG_I("Configuring Model", 0);
+    rd->model->editor->microphone_trigger = rd->manifest.microphone_trigger;
+    atomic_store(&rd->model->mic->multiplier, rd->manifest.microphone_sensitivity);
+
+    LOG_I("Microphone Configured", 0);
+    rd->model->editor->background_color.r = (rd->manifest.background_color >> 16) & 0xFF;
+    rd->model->editor->background_color.g = (rd->manifest.background_color >> 8) & 0xFF;
+    rd->model->editor->background_color.b = rd->manifest.background_color & 0xFF;
+    LOG_I("Background Configured", 0);
+
+    rd->layers = calloc(rd->manifest.number_of_layers, sizeof(struct layer*));
+
+    size_t slot = 0;
+    struct layer_info *info = rd->manifest.layers;
+    while (info) {
+        struct layer_info *next = info->next;
+        info->slot = slot++;
+        info->reader = rd;
+
+        struct work *decode = reader_work(rd, decode_layer, NULL, true, info);
+        struct work *create = reader_work(rd, create_layer, after_create, false, info);
+        work_depends_on(create, decode);
+        work_depends_on(rd->finish, create);
+
+        work_scheduler_add_work(rd->model->scheduler, create);
+        work_scheduler_add_work(rd->model->scheduler, decode);
+        info = next;
+    }
+
+    /* each create node frees its own layer_info */
+    rd->manifest.layers = NULL;
+    LOG_I("Decoding %zu layers", slot);
+}
+
+/* main thread, hands the archive entries to the manifest */
+static int route_blobs(struct model_reader *rd)
+{
+    struct archive_blob *manifest = NULL;
+    int ret = 0;
+
+    for (struct archive_blob *blob = rd->blobs; blob; blob = blob->next) {
+        if (blob->type == AE_IFREG && strcmp(blob->pathname, "manifest.toml") == 0) {
+            manifest = blob;
+            break;
         }
+    }
+
+    if (manifest == NULL) {
+        LOG_E("Unable to find manifest.toml in the model!", 0);
+        return 1;
+    }
+
+    char *config_str = blob_string(manifest);
+    int failed = parse_manifest(rd, config_str);
+    free(config_str);
+    if (failed)
+        return 1;
 
-        mode_t type = archive_entry_filetype(rd->entry);
-        const char *pathname = archive_entry_pathname(rd->entry);
+    struct archive_blob *blob = rd->blobs;
+    while (blob) {
+        struct archive_blob *next = blob->next;
+        const char *pathname = blob->pathname;
 
-        if (type == AE_IFREG) {
-            if (pathname[0] == 'm' && strcmp(pathname, "manifest.toml") == 0) {
-                if (parse_manifest(rd))
-                    rd->state = READER_READ_FAIL;
-                return;
-            } else if (pathname[0] == 'l' && strncmp(pathname, "layers/", 7) == 0) {
+        if (blob->type == AE_IFREG && blob != manifest) {
+            if (ret == 0 && strncmp(pathname, "cache/", 6) == 0) {
+                struct layer_info *layer = manifest_find_layer(&rd->manifest,
+                    pathname);
+
+                /* only a cache, nothing is lost without it */
+                if (layer != NULL) {
+                    layer->pixel_size = blob->size;
+                    layer->pixel_buffer = blob->data;
+                    layer->pixel_borrowed = blob->borrowed;
+                    blob->data = NULL;
+                    blob->borrowed = false;
+                } else
+                    LOG_W("Stray pixel cache in the model - %s???", pathname);
+            } else if (ret == 0 && strncmp(pathname, "layers/", 7) == 0) {
                 struct layer_info *layer = manifest_find_layer(&rd->manifest,
                     pathname);
 
                 if (layer != NULL) {
                     const char *ext = strrchr(pathname, '.') + 1;
-                    size_t data_size = archive_entry_size(rd->entry);
                     if (strcmp(ext, "toml") == 0) {
-                        layer->buffer = calloc(data_size, sizeof(char));
-                        archive_read_data(rd->archive, layer->buffer, data_size);
+                        layer->buffer = blob_string(blob);
                     } else {
-                        layer->image_size = data_size;
-                        layer->image_buffer = calloc(data_size, sizeof(char));
-                        archive_read_data(rd->archive, layer->image_buffer, data_size);
+                        layer->image_size = blob->size;
+                        layer->image_buffer = blob->data;
+                        layer->image_borrowed = blob->borrowed;
+                        blob->data = NULL;
+                        blob->borrowed = false;
                     }
                 } else {
                     LOG_E("Unable to find layer %s! Is it defined in the manifest?",
                         pathname);
-                    rd->state = READER_READ_FAIL;
-                    return;
+                    ret = 1;
                 }
-            } else
+            } else if (ret == 0)
                 LOG_W("Stray file in the model - %s???", pathname);
-        } else if (type == AE_IFDIR) {
-            if (strcmp(pathname, "layers/") != 0)
+        } else if (blob->type == AE_IFDIR) {
+            if (strcmp(pathname, "layers/") != 0 && strcmp(pathname, "cache/") != 0)
                 LOG_W("Stray directory in mode - %s???", pathname);
         }
 
-        archive_read_data_skip(rd->archive);
-        break;
-    }
-    case READER_LAYER_PREPARE: {
-        LOG_I("Configuring Model", 0);
-        rd->model->editor->microphone_trigger = rd->manifest.microphone_trigger;
-        atomic_store(&rd->model->mic->multiplier, rd->manifest.microphone_sensitivity);
-
-        LOG_I("Microphone Configured", 0);
-        rd->model->editor->background_color.r = (rd->manifest.background_color >> 16) & 0xFF;
-        rd->model->editor->background_color.g = (rd->manifest.background_color >> 8) & 0xFF;
-        rd->model->editor->background_color.b = rd->manifest.background_color & 0xFF;
-        LOG_I("Background Configured", 0);
-
-        rd->layers = calloc(rd->manifest.number_of_layers, sizeof(struct layer*));
-        rd->current = rd->manifest.layers;
-        break;
-    }
-    case READER_READ_LAYER_INFO:
-        if (parse_layer_info(rd))
-            rd->state = READER_READ_FAIL;
-        struct layer_info *prev = rd->current;
-        rd->current = rd->current->next;
-        if (prev != NULL)
-            free(prev);
-        rd->current_layer++;
-        if (rd->current == NULL)
-            rd->state = READER_SETUP_TIMERS;
-        break;
-    case READER_READ_LAYER_IMG: {
-        assert(rd->current != NULL && "Was the model not prepared?");
-        if (rd->current->is_animated) {
-            rd->current->img = LoadImageAnimFromMemory(".gif", rd->current->image_buffer,
-                rd->current->image_size, &rd->current->frame_count, &rd->current->delays);
-        } else {
-            rd->current->img = LoadImageFromMemory(".png", rd->current->image_buffer,
-                rd->current->image_size);
+        blob_free(blob);
+        blob = next;
+    }
+    rd->blobs = NULL;
+
+    return ret;
+}
+
+/* main thread, looks every layer up in the index */
+static int route_entries(struct model_reader *rd)
+{
+    if (container_open(&rd->container, rd->mmaped, rd->mmaped_size)) {
+        LOG_E("Unable to read the model index!", 0);
+        return 1;
+    }
+
+    const struct container_entry *entry = container_find(&rd->container,
+        "manifest.toml");
+    if (entry == NULL) {
+        LOG_E("Unable to find manifest.toml in the model!", 0);
+        return 1;
+    }
+
+    char *config_str = (char*) container_read(&rd->container, entry, true);
+    if (config_str == NULL) {
+        LOG_E("Unable to decompress manifest.toml!", 0);
+        return 1;
+    }
+
+    int failed = parse_manifest(rd, config_str);
+    free(config_str);
+    if (failed)
+        return 1;
+
+    for (struct layer_info *info = rd->manifest.layers; info; info = info->next) {
+        info->toml_entry = find_layer_entry(rd, "layers/%s-%zu.%s", info, "toml");
+        info->image_entry = find_layer_entry(rd, "layers/%s-%zu.%s", info,
+            info->is_animated ? "gif" : "png");
+        info->pixel_entry = find_layer_entry(rd, "cache/%s-%zu.%s", info, "pxl");
+
+        if (info->toml_entry == NULL || info->image_entry == NULL) {
+            LOG_E("Unable to find layer %s-%zu in the model!", info->name,
+                info->index);
+            return 1;
         }
-        break;
     }
-    case READER_SETUP_TIMERS:
-        for (int i = 0; i < rd->manifest.number_of_layers; i++) {
-            struct layer *layer = rd->layers[i];
-            if (layer->properties.is_animated)
-                layer_animated_start(layer_get_animated(layer), rd->loop);
+
+    LOG_I("Indexed model with %zu entries", rd->container.entry_count);
+    return 0;
+}
+
+static const struct container_entry *find_layer_entry(struct model_reader *rd,
+    const char *format, struct layer_info *info, const char *ext)
+{
+    int length = snprintf(NULL, 0, format, info->name, info->index, ext);
+    char pathname[length + 1];
+    snprintf(pathname, length + 1, format, info->name, info->index, ext);
+
+    return container_find(&rd->container, pathname);
+}
+
+/* runs on the threadpool, every entry is its own zstd frame */
+static void read_layer_entries(struct layer_info *info)
+{
+    struct container *c = &info->reader->container;
+
+    if (info->toml_entry != NULL)
+        info->buffer = (char*) container_read(c, info->toml_entry, true);
+
+    if (info->image_entry != NULL) {
+        info->image_buffer = container_read(c, info->image_entry, false);
+        info->image_size = info->image_entry->size;
+    }
+
+    if (info->pixel_entry != NULL) {
+        info->pixel_buffer = container_read(c, info->pixel_entry, false);
+        info->pixel_size = info->pixel_entry->size;
+    }
+}
+
+/* runs on the threadpool, touches nothing but its own layer_info */
+static void decode_layer(struct work *work)
+{
+    struct layer_info *info = work->ctx;
+    if (info->reader->indexed)
+        read_layer_entries(info);
+
+    if (!decode_pixel_cache(info) && info->image_buffer != NULL) {
+        if (info->is_animated) {
+            info->img = layer_load_gif(info->image_buffer, info->image_size,
+                &info->frame_count, &info->delays);
+        } else {
+            info->img = LoadImageFromMemory(".png", info->image_buffer,
+                info->image_size);
         }
-        rd->state = READER_READ_DONE;
-        break;
-    case READER_READ_DONE:
-    case READER_READ_FAIL:
-        break;
+    }
+
+    /*
+     * The mapping goes away with the reader. Animated layers stream and
+     * save from their GIF bytes, those are copied. Static layers let go
+     * of theirs instead, the next save encodes them on the threadpool.
+     */
+    if (info->image_borrowed && info->is_animated) {
+        uint8_t *copy = malloc(info->image_size);
+        memcpy(copy, info->image_buffer, info->image_size);
+        info->image_buffer = copy;
+        info->image_borrowed = false;
     }
 }
 
-static void after_read(struct work *work)
+/* adopts the cache entry as image data, false if it is missing or unusable */
+static bool decode_pixel_cache(struct layer_info *info)
 {
-    struct model_reader *rd = work->ctx;
-    switch (rd->state) {
-    case READER_LAYER_PREPARE: 
-    case READER_READ_LAYER_INFO: {
-        if (rd->current == NULL && rd->state == READER_LAYER_PREPARE)
-            break;
-        rd->state = READER_READ_LAYER_IMG;
-        free(work);
-        struct work *wrk = work_new(read_archive, after_read, true);
-        work_set_context(wrk, rd);
+    struct pixel_cache_header header;
+    if (info->pixel_buffer == NULL || info->pixel_size < sizeof(header))
+        return false;
+
+    memcpy(&header, info->pixel_buffer, sizeof(header));
+    if (memcmp(header.magic, PIXEL_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PIXEL_CACHE_VERSION || header.frames == 0 ||
+        header.frames > INT_MAX || (header.frames > 1 && !info->is_animated))
+        return false;
+
+    /* from the file, GetPixelDataSize would overflow its int on these */
+    if (header.width == 0 || header.width > PIXEL_CACHE_MAX_DIMENSION ||
+        header.height == 0 || header.height > PIXEL_CACHE_MAX_DIMENSION ||
+        header.format < PIXELFORMAT_UNCOMPRESSED_GRAYSCALE ||
+        header.format >= PIXELFORMAT_COMPRESSED_DXT1_RGB)
+        return false;
+
+    /* streamed layers would only throw the frames away */
+    if (info->is_animated && layer_animated_streams(header.width, header.height,
+        header.frames))
+        return false;
+
+    /* the entry size bounds the frame count, nothing is multiplied by it */
+    size_t frame_size = (size_t) header.width * header.height *
+        GetPixelDataSize(1, 1, header.format);
+    size_t size = info->pixel_size - sizeof(header);
+    if (frame_size == 0 || size % frame_size != 0 ||
+        size / frame_size != header.frames)
+        return false;
+
+    uint8_t *pixels = info->pixel_buffer;
+    if (info->pixel_borrowed) {
+        /* straight from the mapping into the image, one copy in total */
+        pixels = malloc(size);
+        memcpy(pixels, info->pixel_buffer + sizeof(header), size);
+    } else
+        memmove(pixels, pixels + sizeof(header), size);
+
+    info->img = (Image) {
+        .data = pixels,
+        .width = header.width,
+        .height = header.height,
+        .mipmaps = 1,
+        .format = header.format,
+    };
+    info->frame_count = header.frames;
+    info->pixel_buffer = NULL;
+    info->pixel_borrowed = false;
+    return true;
+}
+
+static void create_layer(struct work *work)
+{
+    struct layer_info *info = work->ctx;
+    struct model_reader *rd = info->reader;
 
-        work_scheduler_add_work(rd->model->scheduler, wrk);
+    if (rd->failed)
         return;
-    }
-    case READER_READ_LAYER_IMG: {
-        rd->state = READER_READ_LAYER_INFO;
-        free(work);
-        struct work *wrk = work_new(read_archive, after_read, false);
-        work_set_context(wrk, rd);
 
-        work_scheduler_add_work(rd->model->scheduler, wrk);
+    if (info->buffer == NULL || info->image_buffer == NULL) {
+        LOG_E("Unable to read layer %s!", info->name);
+        rd->failed = true;
+    } else if (parse_layer_info(rd, info))
+        rd->failed = true;
+}
+
+static void after_create(struct work *work)
+{
+    struct layer_info *info = work->ctx;
+    struct model_reader *rd = info->reader;
+
+    if (rd->layers[info->slot] != NULL) {
+        /* frame delays come from the layer metadata */
+        if (!info->pixel_borrowed)
+            free(info->pixel_buffer);
+        free(info->delays);
+        free(info);
         return;
     }
-    case READER_READ_DONE:
-        rd->model->editor->layer_manager->layers = rd->layers;
-        rd->model->editor->layer_manager->layer_count = rd->manifest.number_of_layers;
-        LOG_I("Layers configured", 0);
-        LOG_I("Model has been loaded!", 0);
-        free(rd);
-        free(work);
+
+    UnloadImage(info->img);
+    layer_info_free(info);
+}
+
+static void finish_load(struct work *work)
+{
+    struct model_reader *rd = work->ctx;
+    if (rd->failed)
         return;
-    case READER_READ_MANIFEST:
-    case READER_READ_FAIL:
-    case READER_SETUP_TIMERS:
-        break;
+
+    for (size_t i = 0; i < rd->manifest.number_of_layers; i++) {
+        struct layer *layer = rd->layers[i];
+        if (layer->properties.is_animated)
+            layer_animated_start(layer_get_animated(layer));
+    }
+
+    /* indexed as they go in, the old ones leave their buckets */
+    layer_manager_replace_layers(rd->model->editor->layer_manager, rd->layers,
+        rd->manifest.number_of_layers);
+    LOG_I("Layers configured", 0);
+    LOG_I("Model has been loaded!", 0);
+    /* the layer manager owns them now */
+    free(rd->layers);
+    rd->layers = NULL;
+}
+
+static void after_load(struct work *work)
+{
+    struct model_reader *rd = work->ctx;
+
+    if (work_cancelled(work))
+        LOG_I("Model load cancelled", 0);
+    else if (rd->failed)
+        LOG_E("Model failed to load!", 0);
+
+    reader_free(rd);
+}
+
+static void reader_free(struct model_reader *rd)
+{
+    if (rd->archive != NULL) {
+        archive_read_close(rd->archive);
+        archive_read_free(rd->archive);
+    }
+
+    struct archive_blob *blob = rd->blobs;
+    while (blob) {
+        struct archive_blob *next = blob->next;
+        blob_free(blob);
+        blob = next;
+    }
+
+    struct layer_info *info = rd->manifest.layers;
+    while (info) {
+        struct layer_info *next = info->next;
+        layer_info_free(info);
+        info = next;
     }
 
-    /* re-schedule */
-    work_scheduler_add_work(rd->model->scheduler, work);
+    if (rd->layers != NULL) {
+        for (size_t i = 0; i < rd->manifest.number_of_layers; i++) {
+            if (rd->layers[i] != NULL)
+                layer_free(rd->layers[i]);
+        }
+        free(rd->layers);
+    }
+
+    if (rd->model->load_token == &rd->token)
+        rd->model->load_token = NULL;
+
+    /* every decode is done by now, nothing borrows from it anymore */
+    container_close(&rd->container);
+    munmap(rd->mmaped, rd->mmaped_size);
+    close(rd->fd);
+    free(rd);
 }
 
-static int parse_layer_info(struct model_reader *rd)
+/* for layers that never made it into a struct layer */
+static void layer_info_free(struct layer_info *info)
+{
+    free(info->name);
+    free(info->buffer);
+    if (!info->image_borrowed)
+        free(info->image_buffer);
+    if (!info->pixel_borrowed)
+        free(info->pixel_buffer);
+    free(info->delays);
+    free(info);
+}
+
+static int parse_layer_info(struct model_reader *rd, struct layer_info *info)
 {
     char errbuf[TOML_ERR_LEN];
     double x, y, rot;
-    int msk, to_live, n_frames;
+    int to_live, n_frames;
+    mask_t msk;
     uint32_t *delays;
     char in = 0;
     bool toggle;
 
-    toml_table_t *conf = toml_parse(rd->current->buffer, errbuf, TOML_ERR_LEN);
+    toml_table_t *conf = toml_parse(info->buffer, errbuf, TOML_ERR_LEN);
     if (conf == NULL) {
         LOG_E("Unable to parse layer metadata: %s!", errbuf);
         return 1;
@@ -330,7 +745,7 @@ static int parse_layer_info(struct model_reader *rd)
     }
     toggle = has_toggle.u.b;
 
-    if (!rd->current->is_animated)
+    if (!info->is_animated)
         goto end;
 
     toml_table_t *animation = toml_table_in(conf, "animation");
@@ -365,14 +780,14 @@ static int parse_layer_info(struct model_reader *rd)
     }
 
 end:
-    if (rd->current->is_animated) {
-        rd->layers[rd->current_layer] = layer_new_animated(rd->current->img, rd->current->frame_count,
-            (uint8_t*) rd->current->buffer, rd->current->image_size, (int*) delays);
+    if (info->is_animated) {
+        rd->layers[info->slot] = layer_new_animated(info->img, info->frame_count,
+            info->image_buffer, info->image_size, (int*) delays);
     } else {
-        rd->layers[rd->current_layer] = layer_new(rd->current->img);
+        rd->layers[info->slot] = layer_new(info->img);
     }
 
-    struct layer *c = rd->layers[rd->current_layer];
+    struct layer *c = rd->layers[info->slot];
     c->properties.offset.x = x;
     c->properties.offset.y = y;
     c->properties.rotation = rot;
@@ -383,32 +798,31 @@ end:
     }
     c->state.time_to_live = to_live;
     c->properties.has_toggle = toggle;
-    layer_override_name(c, rd->current->name);
+    layer_override_name(c, info->name);
 
     if (c->properties.is_animated) {
         struct animated_layer *ac = layer_get_animated(c);
-        ac->properties.number_of_frames = n_frames;
+        /* never past the decoded frames nor the delays */
+        if (n_frames < ac->properties.number_of_frames)
+            ac->properties.number_of_frames = n_frames;
         ac->properties.previous_frame_index = 0;
         ac->properties.current_frame_index = 0;
-        ac->properties.gif_file_content = rd->current->image_buffer;
-        ac->properties.gif_file_size = rd->current->image_size;
-    } else
-        free(rd->current->image_buffer);
+        ac->properties.gif_file_content = info->image_buffer;
+        ac->properties.gif_file_size = info->image_size;
+    } else if (!info->image_borrowed)
+        layer_set_encoded(c, info->image_buffer, info->image_size);
 
     toml_free(conf);
-    free(rd->current->buffer);
+    free(info->buffer);
 
     return 0;
 }
 
-static int parse_manifest(struct model_reader *rd)
+static int parse_manifest(struct model_reader *rd, char *config_str)
 {
     char errbuf[TOML_ERR_LEN];
 
     LOG_I("Reading model manifest", 0);
-    size_t size = archive_entry_size(rd->entry);
-    char *config_str = calloc(size, sizeof(char));
-    archive_read_data(rd->archive, config_str, size);
 
     toml_table_t* conf = toml_parse(config_str, errbuf,
                                     TOML_ERR_LEN);
@@ -474,7 +888,6 @@ static int parse_manifest(struct model_reader *rd)
     LOG_I("Parsed model manifest successfully!", 0);
 
     toml_free(conf);
-    free(config_str);
     return 0;
 }
 
@@ -1,144 +1,281 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "console.h"
 #include <model/model.h>
+#include <model/pixel_cache.h>
+#include <model/container.h>
 #include <archive_entry.h>
 #include <stdbool.h>
 #include <archive.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <work/work.h>
 #include <layer/layer.h>
 
-enum write_state {
-    WRITER_WRITE_MANIFEST,
-    WRITER_WRITE_LAYER_INFO,
-    WRITER_WRITE_LAYER_IMG,
-    WRITER_WRITE_DONE,
+struct model_writer;
+
+struct layer_blob {
+    struct model_writer *writer;
+    struct layer *layer;
+    uint8_t *data;
+    int size;
+    int index;
 };
 
+/*
+ * manifest -> write (per layer, in order) -> done
+ * dirty static layers get an encode node in front of their write
+ */
 struct model_writer {
     struct model *model;
+    /* pinned until after_write, blobs point at its layers */
+    struct layer_manager *mgr;
     struct archive *archive;
     struct archive_entry *entry;
-    enum write_state state;
+    /* used instead of archive when indexed */
+    struct container_writer container;
+    bool indexed;
     int layer_index;
+    bool pixel_cache;
+
+    struct layer_blob *blobs;
+    int layer_count;
 };
 
-static void write_archive(struct work *work);
+static struct work *writer_work(work_fn perform, work_done finished,
+    bool run_on_thread, void *ctx);
+static void write_manifest(struct work *work);
+static void encode_layer(struct work *work);
+static void after_encode(struct work *work);
+static void write_blob(struct work *work);
 static void after_write(struct work *work);
+static void write_layer(struct model_writer *wr, struct layer *layer);
+static void write_pixel_cache(struct model_writer *wr, struct layer *layer);
+static void begin_entry(struct model_writer *writer, const char *pathname, uint64_t size);
+static void write_entry_data(struct model_writer *writer, const void *data, size_t size);
+static void end_entry(struct model_writer *writer);
 static void write_string_to_archive(struct model_writer *writer, const char *pathname, char *str);
 static void write_buffer_to_archive(struct model_writer *writer, const char *pathname, uint8_t *buffer, int size);
 static void add_directory_to_archive(struct model_writer *writer, const char *dirname);
 
-void model_write(struct model *model, const char *path)
+void model_write(struct model *model, const char *path, int flags)
 {
+    /* finish_load frees the layers the encodes and writes would read */
+    if (model->load_token != NULL) {
+        LOG_E("Wait for the model to finish loading before saving %s", path);
+        return;
+    }
+
     struct model_writer *wr = calloc(1, sizeof(struct model_writer));
-    wr->archive = archive_write_new();
+    struct layer_manager *mgr = model->editor->layer_manager;
+    struct work_scheduler *sched = model->scheduler;
     wr->model = model;
+    wr->pixel_cache = flags & MODEL_WRITE_PIXEL_CACHE;
+    wr->indexed = flags & MODEL_WRITE_INDEXED;
 
     LOG_I("Preparing to write %s", path);
 
-    archive_write_add_filter_zstd(wr->archive);
-    archive_write_set_format_pax_restricted(wr->archive);
-    archive_write_open_filename(wr->archive, path);
-    wr->state = WRITER_WRITE_MANIFEST;
+    if (wr->indexed) {
+        if (container_writer_open(&wr->container, path)) {
+            LOG_E("Unable to open %s for writing!", path);
+            free(wr);
+            return;
+        }
+    } else {
+        wr->archive = archive_write_new();
+        archive_write_add_filter_zstd(wr->archive);
+        archive_write_set_format_pax_restricted(wr->archive);
+        archive_write_open_filename(wr->archive, path);
+    }
 
-    struct work *work = work_new(write_archive, after_write, false);
-    work_set_context(work, wr);
+    /* encodes read the images on the threadpool, keep every layer alive */
+    wr->mgr = mgr;
+    layer_manager_pin(mgr);
 
-    work_scheduler_add_work(model->scheduler, work);
-}
+    wr->layer_count = mgr->layer_count;
+    wr->blobs = calloc(wr->layer_count, sizeof(struct layer_blob));
 
-static void write_archive(struct work *work)
-{
-    struct model_writer *wr = work->ctx;
-    switch (wr->state) {
-    case WRITER_WRITE_MANIFEST:
-        LOG_I("Writing Manifest", 0);
-        write_string_to_archive(wr, "manifest.toml",
-            model_generate_manifest(wr->model));
-        add_directory_to_archive(wr, "layers");
-        break;
-    case WRITER_WRITE_LAYER_INFO: {
-        if (wr->layer_index == wr->model->editor->layer_manager->layer_count) {
-            wr->state = WRITER_WRITE_DONE;
-            break;
-        }
-        LOG_I("Writing layer %s",
-            wr->model->editor->layer_manager->layers[wr->layer_index]
-            ->properties.name.buffer);
-        struct layer *layer = wr->model->editor->layer_manager->layers[wr->layer_index];
-        int pathname_len = snprintf(NULL, 0, "layers/%s-%d.toml",
-            layer->properties.name.buffer, wr->layer_index + 1);
+    struct work *manifest = writer_work(write_manifest, NULL, false, wr);
+    struct work *done = writer_work(NULL, after_write, false, wr);
+    struct work *previous = manifest;
+    int encodes = 0;
 
-        char pathname[pathname_len + 1];
-        memset(pathname, 0, pathname_len + 1);
-        snprintf(pathname, pathname_len + 1, "layers/%s-%d.toml",
-            layer->properties.name.buffer, wr->layer_index + 1);
+    for (int i = 0; i < wr->layer_count; i++) {
+        struct layer_blob *blob = &wr->blobs[i];
+        struct layer *layer = mgr->layers[i];
 
-        write_string_to_archive(wr, pathname, layer_stringify(layer));
-        break;
-    }
-    case WRITER_WRITE_LAYER_IMG: {
-        LOG_I("Wrinting Layer Image", 0);
-        struct layer *layer = wr->model->editor->layer_manager->layers[wr->layer_index];
-        struct animated_layer *animated_layer = NULL;
-
-        if (layer->properties.is_animated) {
-            animated_layer = layer_get_animated(layer);
-            int length = snprintf(NULL, 0, "layers/%s-%d.gif",
-                layer->properties.name.buffer, wr->layer_index + 1);
-            char pathname[length + 1];
-            memset(pathname, 0, length + 1);
-            snprintf(pathname, length + 1, "layers/%s-%d.gif", layer->properties.name.buffer,
-                wr->layer_index + 1);
-            write_buffer_to_archive(wr, pathname, animated_layer->properties.gif_file_content,
-                animated_layer->properties.gif_file_size);
-        } else {
-            int length = snprintf(NULL, 0, "layers/%s-%d.png",
-                layer->properties.name.buffer, wr->layer_index + 1);
-            char pathname[length + 1];
-            memset(pathname, 0, length + 1);
-            snprintf(pathname, length + 1, "layers/%s-%d.png", layer->properties.name.buffer,
-                wr->layer_index + 1);
-
-            int filesize = 0;
-            uint8_t *exported = ExportImageToMemory(layer->properties.image, ".png", &filesize);
-            write_buffer_to_archive(wr, pathname, exported, filesize);
-            free(exported);
+        blob->writer = wr;
+        blob->layer = layer;
+        blob->index = i;
+
+        /* layers are appended strictly in index order */
+        struct work *write = writer_work(write_blob, NULL, false, blob);
+        work_depends_on(write, previous);
+
+        if (!layer->properties.is_animated && (layer->properties.is_dirty ||
+            layer->properties.png_file_content == NULL)) {
+            struct work *encode = writer_work(encode_layer, after_encode, true, blob);
+            work_depends_on(write, encode);
+            work_scheduler_add_work(sched, encode);
+            encodes++;
         }
-        break;
-    }
-    case WRITER_WRITE_DONE:
-        break;
+
+        work_scheduler_add_work(sched, write);
+        previous = write;
     }
+
+    work_depends_on(done, previous);
+
+    if (encodes > 0)
+        LOG_I("Encoding %d layers", encodes);
+
+    work_scheduler_add_work(sched, done);
+    work_scheduler_add_work(sched, manifest);
+}
+
+static struct work *writer_work(work_fn perform, work_done finished,
+    bool run_on_thread, void *ctx)
+{
+    struct work *work = work_new(perform, finished, run_on_thread);
+    work_set_context(work, ctx);
+    work_set_priority(work, WORK_PRIORITY_BACKGROUND);
+    return work;
+}
+
+static void write_manifest(struct work *work)
+{
+    struct model_writer *wr = work->ctx;
+
+    LOG_I("Writing Manifest", 0);
+    write_string_to_archive(wr, "manifest.toml",
+        model_generate_manifest(wr->model));
+    add_directory_to_archive(wr, "layers");
+    if (wr->pixel_cache)
+        add_directory_to_archive(wr, "cache");
     /* TODO: Implement script saving */
 }
 
+/* runs on the threadpool, only reads the layer image */
+static void encode_layer(struct work *work)
+{
+    struct layer_blob *blob = work->ctx;
+    blob->data = ExportImageToMemory(blob->layer->properties.image, ".png",
+        &blob->size);
+}
+
+static void after_encode(struct work *work)
+{
+    struct layer_blob *blob = work->ctx;
+
+    /* keep it, the next save can copy it as is */
+    layer_set_encoded(blob->layer, blob->data, blob->size);
+}
+
+static void write_blob(struct work *work)
+{
+    struct layer_blob *blob = work->ctx;
+    struct model_writer *wr = blob->writer;
+
+    wr->layer_index = blob->index;
+    write_layer(wr, blob->layer);
+}
+
 static void after_write(struct work *work)
 {
     struct model_writer *wr = work->ctx;
-    switch (wr->state) {
-    case WRITER_WRITE_MANIFEST:
-        wr->state = WRITER_WRITE_LAYER_INFO;
-        break;
-    case WRITER_WRITE_LAYER_INFO:
-        wr->state = WRITER_WRITE_LAYER_IMG;
-        break;
-    case WRITER_WRITE_LAYER_IMG:
-        wr->layer_index++;
-        wr->state = WRITER_WRITE_LAYER_INFO;
-        break;
-    case WRITER_WRITE_DONE:
+
+    if (wr->indexed) {
+        if (container_writer_close(&wr->container))
+            LOG_E("Model failed to save!", 0);
+        else
+            LOG_I("Model has been saved!", 0);
+    } else {
         archive_write_close(wr->archive);
         archive_write_free(wr->archive);
         LOG_I("Model has been saved!", 0);
-        free(wr);
-        return;
     }
+    layer_manager_unpin(wr->mgr);
+    free(wr->blobs);
+    free(wr);
+}
+
+static void write_layer(struct model_writer *wr, struct layer *layer)
+{
+    LOG_I("Writing layer %s", layer->properties.name.buffer);
+    int pathname_len = snprintf(NULL, 0, "layers/%s-%d.toml",
+        layer->properties.name.buffer, wr->layer_index + 1);
+
+    char pathname[pathname_len + 1];
+    memset(pathname, 0, pathname_len + 1);
+    snprintf(pathname, pathname_len + 1, "layers/%s-%d.toml",
+        layer->properties.name.buffer, wr->layer_index + 1);
+
+    write_string_to_archive(wr, pathname, layer_stringify(layer));
+
+    if (layer->properties.is_animated) {
+        struct animated_layer *animated_layer = layer_get_animated(layer);
+        int length = snprintf(NULL, 0, "layers/%s-%d.gif",
+            layer->properties.name.buffer, wr->layer_index + 1);
+        char pathname[length + 1];
+        memset(pathname, 0, length + 1);
+        snprintf(pathname, length + 1, "layers/%s-%d.gif", layer->properties.name.buffer,
+            wr->layer_index + 1);
+        write_buffer_to_archive(wr, pathname, animated_layer->properties.gif_file_content,
+            animated_layer->properties.gif_file_size);
+    } else {
+        int length = snprintf(NULL, 0, "layers/%s-%d.png",
+            layer->properties.name.buffer, wr->layer_index + 1);
+        char pathname[length + 1];
+        memset(pathname, 0, length + 1);
+        snprintf(pathname, length + 1, "layers/%s-%d.png", layer->properties.name.buffer,
+            wr->layer_index + 1);
+        write_buffer_to_archive(wr, pathname, layer->properties.png_file_content,
+            layer->properties.png_file_size);
+    }
+
+    if (wr->pixel_cache)
+        write_pixel_cache(wr, layer);
+}
+
+static void write_pixel_cache(struct model_writer *wr, struct layer *layer)
+{
+    Image *img = &layer->properties.image;
+    uint32_t frames = 1;
+    if (layer->properties.is_animated) {
+        /* the loader streams it again rather than read a cache this big */
+        if (layer_get_animated(layer)->properties.stream != NULL)
+            return;
+        frames = layer_get_animated(layer)->properties.number_of_frames;
+    }
+
+    struct pixel_cache_header header = {
+        .magic = PIXEL_CACHE_MAGIC,
+        .version = PIXEL_CACHE_VERSION,
+        .width = img->width,
+        .height = img->height,
+        .format = img->format,
+        .frames = frames,
+    };
+    size_t size = (size_t) GetPixelDataSize(img->width, img->height,
+        img->format) * frames;
+
+    int length = snprintf(NULL, 0, "cache/%s-%d.pxl",
+        layer->properties.name.buffer, wr->layer_index + 1);
+    char pathname[length + 1];
+    memset(pathname, 0, length + 1);
+    snprintf(pathname, length + 1, "cache/%s-%d.pxl", layer->properties.name.buffer,
+        wr->layer_index + 1);
 
-    /* re-schedule */
-    work_scheduler_add_work(wr->model->scheduler, work);
+    /* the pixels are not copied, indexed frames are expanded one by one */
+    begin_entry(wr, pathname, sizeof(header) + size);
+    write_entry_data(wr, &header, sizeof(header));
+    if (layer->properties.is_animated) {
+        struct animated_layer *animated = layer_get_animated(layer);
+        for (uint32_t i = 0; i < frames; i++)
+            write_entry_data(wr, layer_animated_frame(animated, i), size / frames);
+    } else
+        write_entry_data(wr, img->data, size);
+    end_entry(wr);
 }
 
 static void write_string_to_archive(struct model_writer *writer, const char *pathname, char *str)
@@ -150,18 +287,48 @@ static void write_string_to_archive(struct model_writer *writer, const char *pat
 
 static void write_buffer_to_archive(struct model_writer *writer, const char *pathname, uint8_t *buffer, int size)
 {
+    begin_entry(writer, pathname, size);
+    write_entry_data(writer, buffer, size);
+    end_entry(writer);
+}
+
+static void begin_entry(struct model_writer *writer, const char *pathname, uint64_t size)
+{
+    if (writer->indexed) {
+        container_writer_begin(&writer->container, pathname, size);
+        return;
+    }
+
     writer->entry = archive_entry_new();
     archive_entry_set_pathname(writer->entry, pathname);
     archive_entry_set_size(writer->entry, size);
     archive_entry_set_filetype(writer->entry, AE_IFREG);
     archive_entry_set_perm(writer->entry, 0644);
     archive_write_header(writer->archive, writer->entry);
-    archive_write_data(writer->archive, buffer, size);
-    archive_entry_free(writer->entry);
+}
+
+static void write_entry_data(struct model_writer *writer, const void *data, size_t size)
+{
+    if (writer->indexed)
+        container_writer_data(&writer->container, data, size);
+    else
+        archive_write_data(writer->archive, data, size);
+}
+
+static void end_entry(struct model_writer *writer)
+{
+    if (writer->indexed)
+        container_writer_end(&writer->container);
+    else
+        archive_entry_free(writer->entry);
 }
 
 static void add_directory_to_archive(struct model_writer *writer, const char *dirname)
 {
+    /* the container has no directories, pathnames are enough */
+    if (writer->indexed)
+        return;
+
     writer->entry = archive_entry_new();
     archive_entry_set_pathname(writer->entry, dirname);
     archive_entry_set_filetype(writer->entry, AE_IFDIR);
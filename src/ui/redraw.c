@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <ui/redraw.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool redraw_needed(struct redraw *r, const struct redraw_state *state,
+    struct nk_context *nk)
+{
+    const uint8_t *commands = nk->memory.memory.ptr;
+    size_t size = nk->memory.allocated;
+
+    if (r->valid && memcmp(&r->last, state, sizeof(struct redraw_state)) == 0 &&
+        r->commands_size == size && memcmp(r->commands, commands, size) == 0)
+        return false;
+
+    if (size > r->commands_capacity) {
+        r->commands_capacity = size * 2;
+        r->commands = realloc(r->commands, r->commands_capacity);
+    }
+
+    memcpy(r->commands, commands, size);
+    r->commands_size = size;
+    memcpy(&r->last, state, sizeof(struct redraw_state));
+    r->valid = true;
+    return true;
+}
+
+void redraw_invalidate(struct redraw *r)
+{
+    r->valid = false;
+}
+
+void redraw_free(struct redraw *r)
+{
+    free(r->commands);
+    memset(r, 0, sizeof(struct redraw));
+}
@@ -1,66 +1,256 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <work/queue.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
-static void work_queue_node_deinit(struct _work_queue_node *node, bool remove_all);
+static struct _work_queue_ring *work_queue_ring_new(size_t capacity);
+static struct _work_queue_ring *work_queue_producer_ring(struct work_queue *queue);
+static struct _work_queue_ring *work_queue_consumer_ring(struct work_queue *queue);
+static void work_queue_reclaim(struct work_queue *queue);
+static int work_queue_push(struct work_queue *queue, struct work *value);
+static int work_queue_grow(struct work_queue *queue, struct _work_queue_ring *full);
+static void work_queue_relax(void);
 
-void work_queue_deinit(struct work_queue *queue)
+void work_queue_cleanup(struct work_queue *queue)
 {
-    work_queue_node_deinit(queue->head, true);
+    struct _work_queue_ring *ring = atomic_load(&queue->first);
+    while (ring != NULL) {
+        struct _work_queue_ring *next = atomic_load(&ring->next);
+        free(ring);
+        ring = next;
+    }
+
+    atomic_store(&queue->first, NULL);
+    atomic_store(&queue->last, NULL);
+    queue->current = NULL;
 }
 
 int work_queue_enqueue(struct work_queue *queue, struct work *value)
 {
-    struct _work_queue_node *node = calloc(1, sizeof(struct _work_queue_node));
-    if (node == NULL)
-        return 1;
+    /* keeps the consumer from freeing a ring this enqueue may still touch */
+    atomic_fetch_add(&queue->producers, 1);
+    int ret = work_queue_push(queue, value);
+    atomic_fetch_sub(&queue->producers, 1);
+    return ret;
+}
 
-    node->data = value;
+void work_queue_dequeue(struct work_queue *queue)
+{
+    struct _work_queue_ring *ring = work_queue_consumer_ring(queue);
+    if (ring == NULL)
+        return;
 
-    if (queue->tail == NULL)
-        queue->head = node;
-    else
-        queue->tail->next = node;
+    size_t pos = ring->head;
+    struct _work_queue_slot *slot = &ring->slots[pos & (ring->capacity - 1)];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
 
-    queue->tail = node;
-    queue->size++;
+    if (seq == pos + 1) {
+        slot->data = NULL;
+        /* hand the slot back to producers for the next lap */
+        atomic_store_explicit(&slot->sequence, pos + ring->capacity,
+            memory_order_release);
+        ring->head = pos + 1;
+    }
 
-    return 0;
+    /* rings moved past, also those left while an enqueue was in flight */
+    if (atomic_load_explicit(&queue->first, memory_order_relaxed) != ring)
+        work_queue_reclaim(queue);
 }
 
-void work_queue_dequeue(struct work_queue *queue)
+struct work *work_queue_front(struct work_queue *queue)
 {
-    struct _work_queue_node *node = queue->head;
-    queue->head = node->next;
+    struct _work_queue_ring *ring = work_queue_consumer_ring(queue);
+    if (ring == NULL)
+        return NULL;
 
-    if (queue->head == NULL)
-        queue->tail = NULL;
+    size_t pos = ring->head;
+    struct _work_queue_slot *slot = &ring->slots[pos & (ring->capacity - 1)];
 
-    work_queue_node_deinit(node, false);
-    queue->size--;
+    /* claimed but not yet published counts as empty */
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) == pos + 1)
+        return slot->data;
+
+    return NULL;
 }
 
-struct work *work_queue_front(struct work_queue *queue)
+/* claimed but unpublished work is counted, front may still say empty */
+size_t work_queue_size(struct work_queue *queue)
+{
+    size_t size = 0;
+    struct _work_queue_ring *ring = work_queue_consumer_ring(queue);
+
+    while (ring != NULL) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size += (tail & ~WORK_QUEUE_CLOSED) - ring->head;
+        ring = atomic_load_explicit(&ring->next, memory_order_acquire);
+    }
+
+    return size;
+}
+
+static int work_queue_push(struct work_queue *queue, struct work *value)
+{
+    for (;;) {
+        struct _work_queue_ring *ring = work_queue_producer_ring(queue);
+        if (ring == NULL)
+            return 1;
+
+        size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+        while (!(pos & WORK_QUEUE_CLOSED)) {
+            struct _work_queue_slot *slot = &ring->slots[pos & (ring->capacity - 1)];
+            size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+            if (diff == 0) {
+                /* slot is free, try to claim it, fails once the ring is closed */
+                if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                    slot->data = value;
+                    atomic_store_explicit(&slot->sequence, pos + 1,
+                        memory_order_release);
+                    return 0;
+                }
+            } else if (diff < 0) {
+                if (work_queue_grow(queue, ring))
+                    return 1;
+                break;
+            } else {
+                pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            }
+        }
+
+        /* closed under us, the next ring is about to be published */
+        while (atomic_load_explicit(&queue->last, memory_order_acquire) == ring)
+            work_queue_relax();
+    }
+}
+
+static struct _work_queue_ring *work_queue_ring_new(size_t capacity)
 {
-    if (queue->head == NULL)
+    struct _work_queue_ring *ring = malloc(sizeof(struct _work_queue_ring) +
+        capacity * sizeof(struct _work_queue_slot));
+    if (ring == NULL)
         return NULL;
 
-    return queue->head->data;
+    atomic_init(&ring->next, NULL);
+    ring->capacity = capacity;
+    atomic_init(&ring->tail, 0);
+    ring->head = 0;
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring->slots[i].sequence, i);
+        ring->slots[i].data = NULL;
+    }
+
+    return ring;
 }
 
-struct work *work_queue_back(struct work_queue *queue)
+/* the ring to enqueue into, the first enqueue allocates it */
+static struct _work_queue_ring *work_queue_producer_ring(struct work_queue *queue)
 {
-    if (queue->tail == NULL)
+    struct _work_queue_ring *ring = atomic_load_explicit(&queue->last,
+        memory_order_acquire);
+    if (ring != NULL)
+        return ring;
+
+    struct _work_queue_ring *fresh = work_queue_ring_new(WORK_QUEUE_MIN_CAPACITY);
+    if (fresh == NULL)
         return NULL;
 
-    return queue->tail->data;
+    struct _work_queue_ring *expected = NULL;
+    if (atomic_compare_exchange_strong(&queue->first, &expected, fresh)) {
+        atomic_store_explicit(&queue->last, fresh, memory_order_release);
+        return fresh;
+    }
+
+    /* someone else got there first, wait for them to publish it */
+    free(fresh);
+    while ((ring = atomic_load_explicit(&queue->last, memory_order_acquire)) == NULL)
+        work_queue_relax();
+
+    return ring;
+}
+
+/* the ring the front is in, drained and closed rings are skipped */
+static struct _work_queue_ring *work_queue_consumer_ring(struct work_queue *queue)
+{
+    struct _work_queue_ring *ring = queue->current;
+    if (ring == NULL) {
+        ring = atomic_load_explicit(&queue->first, memory_order_acquire);
+        if (ring == NULL)
+            return NULL;
+        queue->current = ring;
+    }
+
+    for (;;) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (!(tail & WORK_QUEUE_CLOSED) || (tail & ~WORK_QUEUE_CLOSED) != ring->head)
+            return ring;
+
+        /* closed and drained, nothing can land in it any more */
+        struct _work_queue_ring *next = atomic_load_explicit(&ring->next,
+            memory_order_acquire);
+        if (next == NULL)
+            return ring;
+
+        queue->current = ring = next;
+    }
 }
 
-static void work_queue_node_deinit(struct _work_queue_node *node, bool remove_all)
+/*
+ * Frees the rings before current, they are drained and closed. An
+ * enqueue in flight may have loaded one from last before it moved on,
+ * once none is, every producer loads a ring from current on.
+ */
+static void work_queue_reclaim(struct work_queue *queue)
 {
-    if (remove_all && node->next)
-        work_queue_node_deinit(node->next, remove_all);
+    if (atomic_load(&queue->producers) != 0)
+        return;
 
-    free(node);
+    struct _work_queue_ring *ring = atomic_load(&queue->first);
+    while (ring != queue->current) {
+        struct _work_queue_ring *next = atomic_load(&ring->next);
+        free(ring);
+        ring = next;
+    }
+
+    atomic_store(&queue->first, ring);
+}
+
+/*
+ * Closes the full ring and publishes one twice its size. Returns 0 when
+ * the queue has a new ring, also when someone else closed it first, 1 on
+ * allocation failure.
+ */
+static int work_queue_grow(struct work_queue *queue, struct _work_queue_ring *full)
+{
+    struct _work_queue_ring *ring = work_queue_ring_new(full->capacity * 2);
+    if (ring == NULL)
+        return 1;
+
+    size_t tail = atomic_fetch_or(&full->tail, WORK_QUEUE_CLOSED);
+    if (tail & WORK_QUEUE_CLOSED) {
+        free(ring);
+        return 0;
+    }
+
+    /* the consumer drains full before it follows next */
+    atomic_store_explicit(&full->next, ring, memory_order_release);
+    atomic_store_explicit(&queue->last, ring, memory_order_release);
+    return 0;
+}
+
+/* tells the core it is spinning, publishing a ring takes a few stores */
+static void work_queue_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ volatile("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
 }
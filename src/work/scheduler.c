@@ -2,21 +2,65 @@
 #include <work/scheduler.h>
 #include <work/queue.h>
 #include <work/work.h>
+#include <uv.h>
 
 void work_scheduler_add_work(struct work_scheduler *sched, struct work *work)
 {
-    work_queue_enqueue(&sched->queue, work);
+    work->sched = sched;
+    if (work->token != NULL && work->token->sched == NULL)
+        work->token->sched = sched;
+
+    /* parked, the last dependency to finish submits it again */
+    if (work->unmet > 0)
+        return;
+
+    work_queue_enqueue(&sched->queues[work->priority], work);
+}
+
+void work_scheduler_set_budget(struct work_scheduler *sched, uint64_t budget_us)
+{
+    sched->budget_us = budget_us;
+}
+
+void work_scheduler_cancel(struct work_scheduler *sched, struct work_token *token)
+{
+    /* a token nothing was submitted with yet is claimed by the first cancel */
+    if (token->sched == NULL)
+        token->sched = sched;
+    else if (token->sched != sched)
+        return;
+
+    /* queued work is flushed through its finished callback on the next run */
+    work_token_cancel(token);
 }
 
 void work_scheduler_run(struct work_scheduler *sched)
 {
-    size_t count = sched->queue.size;
+    uint64_t start = uv_hrtime();
+    uint64_t budget_ns = sched->budget_us * 1000;
+
+    for (int i = 0; i < WORK_PRIORITY_COUNT; i++) {
+        struct work_queue *queue = &sched->queues[i];
+        size_t count = work_queue_size(queue);
+
+        while (count--) {
+            struct work *w = NULL;
+            if ((w = work_queue_front(queue)) !=  NULL) {
+                /* handing work to the threadpool is cheap, running it here is not */
+                if (!w->thread_safe && !work_cancelled(w) && budget_ns > 0 &&
+                    uv_hrtime() - start >= budget_ns)
+                    break; /* the rest waits for the next frame */
 
-    while (count--) {
-        struct work *w = NULL;
-        if ((w = work_queue_front(&sched->queue)) !=  NULL)
-            work_evaluate(w, sched->loop);
+                work_evaluate(w, sched->loop);
+            }
 
-        work_queue_dequeue(&sched->queue);
+            work_queue_dequeue(queue);
+        }
     }
 }
+
+void work_scheduler_cleanup(struct work_scheduler *sched)
+{
+    for (int i = 0; i < WORK_PRIORITY_COUNT; i++)
+        work_queue_cleanup(&sched->queues[i]);
+}
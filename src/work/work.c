@@ -1,12 +1,16 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unuv.h>
 #include <uv.h>
 #include <work/work.h>
+#include <work/scheduler.h>
 
 static void on_work(uv_work_t *w);
 static void on_work_done(uv_work_t *w, int s);
+static void work_complete(struct work *work);
 
 struct work *work_new(work_fn perform, work_done when_finished, bool run_on_thread)
 {
@@ -14,6 +18,7 @@ struct work *work_new(work_fn perform, work_done when_finished, bool run_on_thre
     w->perform = perform;
     w->finished = when_finished;
     w->thread_safe = run_on_thread;
+    w->priority = WORK_PRIORITY_INTERACTIVE;
     w->req.data = w;
 
     return w;
@@ -24,25 +29,88 @@ void work_set_context(struct work *work, void *context)
     work->ctx = context;
 }
 
+void work_set_priority(struct work *work, enum work_priority priority)
+{
+    work->priority = priority;
+}
+
+void work_set_token(struct work *work, struct work_token *token)
+{
+    work->token = token;
+}
+
+void work_depends_on(struct work *work, struct work *dependency)
+{
+    if (dependency->dependent_count == dependency->dependent_capacity) {
+        size_t capacity = dependency->dependent_capacity ?
+            dependency->dependent_capacity * 2 : 4;
+        struct work **dependents = realloc(dependency->dependents,
+            capacity * sizeof(struct work*));
+        if (dependents == NULL) {
+            perror("realloc");
+            abort();
+        }
+
+        dependency->dependents = dependents;
+        dependency->dependent_capacity = capacity;
+    }
+
+    dependency->dependents[dependency->dependent_count++] = work;
+    work->unmet++;
+}
+
+bool work_cancelled(struct work *work)
+{
+    return work->token != NULL && atomic_load(&work->token->cancelled);
+}
+
+void work_token_cancel(struct work_token *token)
+{
+    atomic_store(&token->cancelled, true);
+}
+
 void work_evaluate(struct work *work, un_loop *loop)
 {
+    if (work_cancelled(work)) {
+        work_complete(work);
+        return;
+    }
+
     if (work->thread_safe) {
         uv_queue_work((uv_loop_t*) loop, &work->req, on_work, on_work_done);
         return;
     }
 
-    work->perform(work);
-    work->finished(work);
+    if (work->perform)
+        work->perform(work);
+    work_complete(work);
 }
 
 static void on_work(uv_work_t *w)
 {
     struct work *work = w->data;
-    work->perform(work);
+    if (work->perform && !work_cancelled(work))
+        work->perform(work);
 }
 
 static void on_work_done(uv_work_t *w, int _)
 {
     struct work *work = w->data;
-    work->finished(work);
+    work_complete(work);
+}
+
+/* main thread, releases whatever was waiting on work */
+static void work_complete(struct work *work)
+{
+    if (work->finished)
+        work->finished(work);
+
+    for (size_t i = 0; i < work->dependent_count; i++) {
+        struct work *dependent = work->dependents[i];
+        if (--dependent->unmet == 0 && dependent->sched != NULL)
+            work_scheduler_add_work(dependent->sched, dependent);
+    }
+
+    free(work->dependents);
+    free(work);
 }